@@ -1,15 +1,45 @@
 #include <iostream>
 #include <vector>
+#include <array>
+#include <deque>
+#include <map>
 #include <string>
-#include <set>
 #include <sstream>
+#include <fstream>
 #include <algorithm>
 #include <cctype>
 #include <cstdint>
 #include <cmath>
+#include <chrono>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <cstring>
+#include <climits>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#define USE_PEXT
+#endif
+// NNUE kernels: AVX2 or SSE4.1 when the compiler targets them, else scalar.
+#if defined(__AVX2__) && !defined(NO_SIMD)
+#define USE_AVX2
+#elif defined(__SSE4_1__) && !defined(NO_SIMD)
+#define USE_SSE41
+#endif
+#if defined(USE_PEXT) || defined(USE_AVX2) || defined(USE_SSE41)
+#include <immintrin.h>
+#endif
 using namespace std;
 
-enum Piece
+enum Piece : uint8_t
 {
     EMPTY,
     PAWN,
@@ -20,7 +50,7 @@ enum Piece
     KING
 };
 
-enum Color
+enum Color : uint8_t
 {
     NONE,
     WHITE,
@@ -35,27 +65,287 @@ struct Square
     Square(Piece p, Color c) : piece(p), color(c) {}
 };
 
+enum MoveType
+{
+    NORMAL,
+    PROMOTION,
+    EN_PASSANT,
+    CASTLING
+};
+
+// Which part of the legal moves to generate. Promotions count as captures
+// (they change material); castling is a quiet move. EVASIONS is every legal
+// move when the side to move is in check.
+enum GenType
+{
+    ALL_MOVES,
+    CAPTURES,
+    QUIETS,
+    EVASIONS
+};
+
+// A move packed into 16 bits: bits 0-5 hold the from square, bits 6-11 the to
+// square (both row * 8 + col), bits 12-13 the promotion piece (knight..queen)
+// and bits 14-15 the MoveType. The moving piece and its color are read from
+// the board. Castling is encoded as the king's two-square move.
 struct Move
 {
-    Piece piece;         // The piece being moved
-    Color color;         // Color of the piece
-    pair<int, int> from; // Starting position (row, col)
-    pair<int, int> to;   // Ending position (row, col)
-    Piece promotedPiece; // In case of promotion
+    uint16_t data;
+
+    Move() = default;
+    constexpr explicit Move(uint16_t raw) : data(raw) {}
+    Move(int from, int to, MoveType type = NORMAL, Piece promo = KNIGHT)
+        : data(uint16_t(from | (to << 6) | ((promo - KNIGHT) << 12) | (type << 14))) {}
+
+    // The null move; never produced by the generators since from == to.
+    static constexpr Move none()
+    {
+        return Move(uint16_t(0));
+    }
+
+    int from() const
+    {
+        return data & 63;
+    }
+
+    int to() const
+    {
+        return (data >> 6) & 63;
+    }
+
+    MoveType type() const
+    {
+        return MoveType(data >> 14);
+    }
+
+    Piece promotedPiece() const
+    {
+        return type() == PROMOTION ? Piece(KNIGHT + ((data >> 12) & 3)) : EMPTY;
+    }
+
+    bool operator==(const Move &other) const
+    {
+        return data == other.data;
+    }
+
+    bool operator!=(const Move &other) const
+    {
+        return data != other.data;
+    }
+};
+
+// Fixed-capacity move list that lives on the stack; no position has more than
+// 218 legal moves, so 256 also covers the pseudo-legal ones.
+struct MoveList
+{
+    Move moves[256];
+    int count = 0;
+
+    void add(Move move)
+    {
+        moves[count++] = move;
+    }
+
+    int size() const
+    {
+        return count;
+    }
+
+    Move &operator[](int i)
+    {
+        return moves[i];
+    }
+
+    const Move *begin() const
+    {
+        return moves;
+    }
+
+    const Move *end() const
+    {
+        return moves + count;
+    }
+};
+
+// --- Telemetry ---
+// Counters for tuning deployments, compiled in only with -DTELEMETRY; in a
+// normal build the hooks expand to nothing. Each thread counts into its own
+// thread_local block and adds it to the shared totals when it finishes a
+// piece of work, so the hot paths never touch shared memory.
+
+struct Telemetry
+{
+    uint64_t nodes = 0, qnodes = 0;
+    uint64_t ttProbes = 0, ttHits = 0;
+    uint64_t ttCollisions = 0; // Misses in a bucket full of other positions.
+    uint64_t cutoffs = 0, firstMoveCutoffs = 0;
+    uint64_t iterations = 0;   // Iterations with a previous one to compare with.
+    double branchingSum = 0;   // Their node counts over the previous iteration's.
+    uint64_t movegenCalls = 0, movegenNanos = 0;
+    uint64_t applyCalls = 0, applyNanos = 0;
+    uint64_t evalCalls = 0, evalNanos = 0;
+
+    void add(const Telemetry &other)
+    {
+        nodes += other.nodes;
+        qnodes += other.qnodes;
+        ttProbes += other.ttProbes;
+        ttHits += other.ttHits;
+        ttCollisions += other.ttCollisions;
+        cutoffs += other.cutoffs;
+        firstMoveCutoffs += other.firstMoveCutoffs;
+        iterations += other.iterations;
+        branchingSum += other.branchingSum;
+        movegenCalls += other.movegenCalls;
+        movegenNanos += other.movegenNanos;
+        applyCalls += other.applyCalls;
+        applyNanos += other.applyNanos;
+        evalCalls += other.evalCalls;
+        evalNanos += other.evalNanos;
+    }
+
+    double branchingFactor() const
+    {
+        return iterations ? branchingSum / iterations : 0;
+    }
+
+    double firstMoveCutoffRate() const
+    {
+        return cutoffs ? double(firstMoveCutoffs) / cutoffs : 0;
+    }
+
+    string toJson() const
+    {
+        ostringstream out;
+        out << fixed << setprecision(3) << "{\"nodes\":" << nodes
+            << ",\"qnodes\":" << qnodes << ",\"tt\":{\"probes\":" << ttProbes << ",\"hits\":" << ttHits
+            << ",\"collisions\":" << ttCollisions << "},\"cutoffs\":" << cutoffs << ",\"firstMoveCutoffs\":" << firstMoveCutoffs
+            << ",\"firstMoveCutoffRate\":" << firstMoveCutoffRate() << ",\"branchingFactor\":" << branchingFactor()
+            << ",\"movegen\":{\"calls\":" << movegenCalls << ",\"ms\":" << movegenNanos / 1e6 << "},\"applyMove\":{\"calls\":"
+            << applyCalls << ",\"ms\":" << applyNanos / 1e6 << "},\"eval\":{\"calls\":" << evalCalls << ",\"ms\":"
+            << evalNanos / 1e6 << "}}";
+        return out.str();
+    }
+
+    vector<string> toText() const
+    {
+        auto percent = [](uint64_t part, uint64_t whole) {
+            ostringstream out;
+            out << fixed << setprecision(1) << (whole ? 100.0 * part / whole : 0.0) << "%";
+            return out.str();
+        };
+        auto timing = [](uint64_t calls, uint64_t nanos) {
+            ostringstream out;
+            out << calls << " calls, " << fixed << setprecision(1) << nanos / 1e6 << " ms, "
+                << (calls ? double(nanos) / calls : 0.0) << " ns/call";
+            return out.str();
+        };
+        ostringstream ebf;
+        ebf << fixed << setprecision(2) << branchingFactor();
+        return { "nodes " + to_string(nodes) + " qnodes " + to_string(qnodes),
+                 "tt probes " + to_string(ttProbes) + " hits " + percent(ttHits, ttProbes) + " collisions " +
+                     percent(ttCollisions, ttProbes),
+                 "cutoffs " + to_string(cutoffs) + " on first move " + percent(firstMoveCutoffs, cutoffs) +
+                     " branching factor " + ebf.str(),
+                 "movegen " + timing(movegenCalls, movegenNanos), "applyMove " + timing(applyCalls, applyNanos),
+                 "eval " + timing(evalCalls, evalNanos) };
+    }
+};
+
+#ifdef TELEMETRY
+const bool telemetryEnabled = true;
+thread_local Telemetry telemetry;
+
+// Adds one call and the time until it goes out of scope to a pair of counters.
+class TelemetryTimer
+{
+private:
+    uint64_t &calls, &nanos;
+    chrono::steady_clock::time_point start;
 
-    Move(Piece p, Color c, pair<int, int> f, pair<int, int> t, Piece promo = EMPTY)
-        : piece(p), color(c), from(f), to(t), promotedPiece(promo) {}
+public:
+    TelemetryTimer(uint64_t &callCounter, uint64_t &nanoCounter)
+        : calls(callCounter), nanos(nanoCounter), start(chrono::steady_clock::now())
+    {
+    }
 
-    bool operator<(const Move &other) const
+    ~TelemetryTimer()
     {
-        if (from != other.from)
-            return from < other.from;
-        if (to != other.to)
-            return to < other.to;
-        return promotedPiece < other.promotedPiece;
+        calls++;
+        nanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
     }
 };
 
+#define TELEMETRY_COUNT(field) (telemetry.field++)
+#define TELEMETRY_TIME(calls, nanos) TelemetryTimer telemetryTimer(telemetry.calls, telemetry.nanos)
+#else
+const bool telemetryEnabled = false;
+#define TELEMETRY_COUNT(field) ((void)0)
+#define TELEMETRY_TIME(calls, nanos) ((void)0)
+#endif
+
+mutex telemetryLock;
+Telemetry telemetryTotal;
+
+// Moves the calling thread's counters into the totals.
+void telemetryFlush()
+{
+#ifdef TELEMETRY
+    lock_guard<mutex> guard(telemetryLock);
+    telemetryTotal.add(telemetry);
+    telemetry = Telemetry();
+#endif
+}
+
+Telemetry telemetrySnapshot()
+{
+    telemetryFlush();
+    lock_guard<mutex> guard(telemetryLock);
+    return telemetryTotal;
+}
+
+void telemetryReset()
+{
+    telemetryFlush();
+    lock_guard<mutex> guard(telemetryLock);
+    telemetryTotal = Telemetry();
+}
+
+// --- Bitboard Helpers ---
+// Squares are indexed row * 8 + col, so bit 0 is (0,0) (a8) and bit 63 is (7,7) (h1).
+
+constexpr int squareIndex(int row, int col)
+{
+    return row * 8 + col;
+}
+
+constexpr uint64_t squareBit(int sq)
+{
+    return 1ULL << sq;
+}
+
+inline int popCount(uint64_t b)
+{
+    return __builtin_popcountll(b);
+}
+
+inline int lsb(uint64_t b)
+{
+    return __builtin_ctzll(b);
+}
+
+inline int msb(uint64_t b)
+{
+    return 63 - __builtin_clzll(b);
+}
+
+inline int popLsb(uint64_t &b)
+{
+    int sq = lsb(b);
+    b &= b - 1;
+    return sq;
+}
+
 struct Bitboards
 {
     uint64_t whitePawns;
@@ -70,522 +360,6669 @@ struct Bitboards
     uint64_t blackRooks;
     uint64_t blackQueens;
     uint64_t blackKing;
+
+    // Occupancy unions, kept in step with the piece sets above.
+    uint64_t whitePieces;
+    uint64_t blackPieces;
+    uint64_t allPieces;
+
+    uint64_t &pieces(Piece piece, Color color)
+    {
+        return this->*pieceField(piece, color);
+    }
+
+    uint64_t pieces(Piece piece, Color color) const
+    {
+        return this->*pieceField(piece, color);
+    }
+
+    uint64_t &occupancy(Color color)
+    {
+        return color == WHITE ? whitePieces : blackPieces;
+    }
+
+    uint64_t occupancy(Color color) const
+    {
+        return color == WHITE ? whitePieces : blackPieces;
+    }
+
+private:
+    static uint64_t Bitboards::*pieceField(Piece piece, Color color)
+    {
+        static uint64_t Bitboards::*const fields[2][7] = {
+            { nullptr, &Bitboards::whitePawns, &Bitboards::whiteKnights, &Bitboards::whiteBishops,
+              &Bitboards::whiteRooks, &Bitboards::whiteQueens, &Bitboards::whiteKing },
+            { nullptr, &Bitboards::blackPawns, &Bitboards::blackKnights, &Bitboards::blackBishops,
+              &Bitboards::blackRooks, &Bitboards::blackQueens, &Bitboards::blackKing }
+        };
+        assert(piece != EMPTY);
+        return fields[color == BLACK][piece];
+    }
+};
+
+// --- Attack Tables ---
+// Knight, king and pawn attacks are looked up per square. Bishop and rook attacks
+// come from magic bitboards: the relevant occupancy is hashed (or PEXT-compressed
+// when BMI2 is available) into an index into a shared attack table.
+
+struct Magic
+{
+    uint64_t mask;
+    uint64_t magic;
+    uint64_t *attacks;
+    int shift;
+
+    unsigned index(uint64_t occupied) const
+    {
+#ifdef USE_PEXT
+        return (unsigned)_pext_u64(occupied, mask);
+#else
+        return (unsigned)(((occupied & mask) * magic) >> shift);
+#endif
+    }
+};
+
+// Knight, king and pawn attacks are built by the compiler.
+constexpr int knightSteps[8][2] = { { -2, -1 }, { -2, 1 }, { -1, -2 }, { -1, 2 },
+                                    { 1, -2 }, { 1, 2 }, { 2, -1 }, { 2, 1 } };
+constexpr int kingSteps[8][2] = { { -1, -1 }, { -1, 0 }, { -1, 1 },
+                                  { 0, -1 },            { 0, 1 },
+                                  { 1, -1 },  { 1, 0 }, { 1, 1 } };
+
+template <size_t N>
+constexpr array<uint64_t, 64> stepAttacks(const int (&steps)[N][2])
+{
+    array<uint64_t, 64> table{};
+    for (int sq = 0; sq < 64; sq++)
+        for (size_t i = 0; i < N; i++)
+        {
+            int r = sq / 8 + steps[i][0], c = sq % 8 + steps[i][1];
+            if (r >= 0 && r < 8 && c >= 0 && c < 8)
+                table[sq] |= squareBit(squareIndex(r, c));
+        }
+    return table;
+}
+
+// White pawns capture towards row 0, Black pawns towards row 7.
+constexpr int whitePawnSteps[2][2] = { { -1, -1 }, { -1, 1 } };
+constexpr int blackPawnSteps[2][2] = { { 1, -1 }, { 1, 1 } };
+
+constexpr array<uint64_t, 64> knightAttacks = stepAttacks(knightSteps);
+constexpr array<uint64_t, 64> kingAttacks = stepAttacks(kingSteps);
+constexpr array<array<uint64_t, 64>, 3> pawnAttacks = { {
+    {}, stepAttacks(whitePawnSteps), stepAttacks(blackPawnSteps) } }; // Indexed by the attacking color.
+
+static_assert(knightAttacks[0] == (squareBit(10) | squareBit(17)), "knight table");
+static_assert(kingAttacks[63] == (squareBit(54) | squareBit(55) | squareBit(62)), "king table");
+static_assert(pawnAttacks[WHITE][8] == squareBit(1) && pawnAttacks[BLACK][8] == squareBit(17), "pawn tables");
+
+uint64_t betweenBB[64][64];  // Squares strictly between two aligned squares.
+uint64_t lineBB[64][64];     // The whole line through two aligned squares.
+Magic bishopMagics[64];
+Magic rookMagics[64];
+uint64_t bishopTable[0x1480];
+uint64_t rookTable[0x19000];
+
+const int bishopDirections[4][2] = { { -1, -1 }, { -1, 1 }, { 1, -1 }, { 1, 1 } };
+const int rookDirections[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+inline uint64_t bishopAttacks(int sq, uint64_t occupied)
+{
+    const Magic &m = bishopMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+inline uint64_t rookAttacks(int sq, uint64_t occupied)
+{
+    const Magic &m = rookMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+inline uint64_t queenAttacks(int sq, uint64_t occupied)
+{
+    return bishopAttacks(sq, occupied) | rookAttacks(sq, occupied);
+}
+
+// Walks the rays from a square; only used to build the tables.
+uint64_t slidingAttacks(int sq, uint64_t occupied, const int directions[4][2])
+{
+    uint64_t attacks = 0;
+    for (int d = 0; d < 4; d++)
+    {
+        int r = sq / 8, c = sq % 8;
+        while (true)
+        {
+            r += directions[d][0];
+            c += directions[d][1];
+            if (r < 0 || r >= 8 || c < 0 || c >= 8)
+                break;
+            attacks |= squareBit(squareIndex(r, c));
+            if (occupied & squareBit(squareIndex(r, c)))
+                break;
+        }
+    }
+    return attacks;
+}
+
+// Magic multipliers for the row * 8 + col square order, found offline with a
+// sparse random search over the same masks initMagics builds.
+const uint64_t bishopMagicNumbers[64] = {
+    0x40106000A1160020ULL, 0x0230106090808800ULL, 0x4010210041000800ULL, 0x02240400980C2000ULL,
+    0x1304030800402088ULL, 0x140A0F1008000002ULL, 0x0001043002088080ULL, 0x0431240044102800ULL,
+    0x0000400222021200ULL, 0x0040080880809206ULL, 0x0420044104250001ULL, 0x0008841046010A40ULL,
+    0x2000020210001000ULL, 0x4000C20190080000ULL, 0x0404020801041004ULL, 0x0004004048241040ULL,
+    0x8008802002104A20ULL, 0x08080802B0840080ULL, 0x1008082A42040020ULL, 0x2118010402142012ULL,
+    0x2002800400A08004ULL, 0x2108080082012020ULL, 0x2054038069080800ULL, 0x0000400202020110ULL,
+    0x0230404825040481ULL, 0x1030310108012102ULL, 0x8808020A11140105ULL, 0x0014040038020808ULL,
+    0x2084040018410040ULL, 0x8409420001C11030ULL, 0x000088904C020830ULL, 0x00032A0401420080ULL,
+    0xA204824014602422ULL, 0xC9021A1308E00824ULL, 0x0404020100420400ULL, 0x2800600800048820ULL,
+    0x00084A0020120080ULL, 0x00041000800C1040ULL, 0x2004081880004400ULL, 0x0042040031250091ULL,
+    0xC20A082008004400ULL, 0x1124010882122800ULL, 0x8842010101002081ULL, 0x4001044200808808ULL,
+    0x0000240102122400ULL, 0x3082240806020221ULL, 0x803010B218808040ULL, 0x1034A40400400020ULL,
+    0x4081040120690000ULL, 0x00420A12090C8500ULL, 0x0808420124090940ULL, 0x1110050042020001ULL,
+    0x0D60224099024000ULL, 0x0100084218820081ULL, 0x08882048088504A8ULL, 0x2406088F01060390ULL,
+    0x000202010C829000ULL, 0x0260010421010810ULL, 0x0004200A004208A0ULL, 0x0222000800208821ULL,
+    0x0083040004104421ULL, 0x2011808810100224ULL, 0x2102A02002208100ULL, 0x0002420441020602ULL
+};
+
+const uint64_t rookMagicNumbers[64] = {
+    0x0A80004000801220ULL, 0x10C0100040002000ULL, 0x0100102000410009ULL, 0x0B0021000C100008ULL,
+    0x4080080080040002ULL, 0x0200019004080200ULL, 0x0400080A10112684ULL, 0x20800A4D00062080ULL,
+    0x2091800020804000ULL, 0x0044401000200040ULL, 0x1001002000401108ULL, 0x1001800801100081ULL,
+    0x0001000500080010ULL, 0x1000808002000400ULL, 0x0404000482100108ULL, 0x0003000182610002ULL,
+    0x0440848002C00420ULL, 0x2010890040010021ULL, 0x8800110020044300ULL, 0x0208010100201000ULL,
+    0x1222020004102008ULL, 0x0000808002000400ULL, 0x20040400094A9008ULL, 0x0000420000804401ULL,
+    0x0040002880004680ULL, 0x0000200240100040ULL, 0x0020008180201001ULL, 0x01080080800C1000ULL,
+    0x0104040080800800ULL, 0x4800020080040080ULL, 0x0002000200840108ULL, 0x00A1000100006082ULL,
+    0x8004400088800260ULL, 0x0100804000802008ULL, 0x0010008010802002ULL, 0x000C801000800800ULL,
+    0x0C51800402800800ULL, 0x0002800200800400ULL, 0x0000820804000110ULL, 0x4003808042000401ULL,
+    0x00208020C0018000ULL, 0x4400402010004009ULL, 0x22100400A800E000ULL, 0x0E020021400A0013ULL,
+    0x10A0080100110005ULL, 0x0004010002004040ULL, 0x0024080102040010ULL, 0x4154089108420014ULL,
+    0x0182400080002380ULL, 0x0000400110802100ULL, 0x0000100080200480ULL, 0x100A000820401200ULL,
+    0x8081004020801002ULL, 0x0002000408100200ULL, 0x03223A1008010C00ULL, 0x000000831C014200ULL,
+    0x4200208009001041ULL, 0xC001004000881021ULL, 0x1008200100100841ULL, 0x0000082240920032ULL,
+    0x4002000804201102ULL, 0xB821000804000201ULL, 0x4080C208102100A4ULL, 0x02020900418C0CA2ULL
+};
+
+void initMagics(Magic magics[64], uint64_t *table, const uint64_t magicNumbers[64],
+                const int directions[4][2])
+{
+    uint64_t *next = table;
+
+    for (int sq = 0; sq < 64; sq++)
+    {
+        int row = sq / 8, col = sq % 8;
+        // Board edges never affect the attack set unless the piece stands on them.
+        uint64_t edges = ((0xFFULL | 0xFF00000000000000ULL) & ~(0xFFULL << (row * 8))) |
+                         ((0x0101010101010101ULL | 0x8080808080808080ULL) & ~(0x0101010101010101ULL << col));
+        Magic &m = magics[sq];
+        m.mask = slidingAttacks(sq, 0, directions) & ~edges;
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = next;
+
+        m.magic = magicNumbers[sq];
+        next += 1ULL << popCount(m.mask);
+
+        // Fill the table for every subset of the mask (Carry-Rippler trick).
+        uint64_t subset = 0;
+        do
+        {
+            m.attacks[m.index(subset)] = slidingAttacks(sq, subset, directions);
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+    }
+}
+
+void initAttackTables()
+{
+    initMagics(bishopMagics, bishopTable, bishopMagicNumbers, bishopDirections);
+    initMagics(rookMagics, rookTable, rookMagicNumbers, rookDirections);
+
+    for (int s1 = 0; s1 < 64; s1++)
+    {
+        for (int s2 = 0; s2 < 64; s2++)
+        {
+            betweenBB[s1][s2] = lineBB[s1][s2] = 0;
+            uint64_t ends = squareBit(s1) | squareBit(s2);
+            if (s1 != s2 && (bishopAttacks(s1, 0) & squareBit(s2)))
+            {
+                lineBB[s1][s2] = (bishopAttacks(s1, 0) & bishopAttacks(s2, 0)) | ends;
+                betweenBB[s1][s2] = bishopAttacks(s1, squareBit(s2)) & bishopAttacks(s2, squareBit(s1));
+            }
+            if (s1 != s2 && (rookAttacks(s1, 0) & squareBit(s2)))
+            {
+                lineBB[s1][s2] = (rookAttacks(s1, 0) & rookAttacks(s2, 0)) | ends;
+                betweenBB[s1][s2] = rookAttacks(s1, squareBit(s2)) & rookAttacks(s2, squareBit(s1));
+            }
+        }
+    }
+}
+
+// --- Zobrist Hashing ---
+// A position's key is the XOR of one random number per (color, piece, square)
+// present, plus numbers for the side to move, the castling rights and the en
+// passant file. Each move changes only a few terms, so the key is updated
+// incrementally.
+
+// Deterministic xorshift64* generator, so keys are identical across runs.
+struct PRNG
+{
+    uint64_t s;
+    explicit PRNG(uint64_t seed) : s(seed) {}
+
+    uint64_t rand64()
+    {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+};
+
+uint64_t zobristPieces[3][7][64]; // Indexed by Color, Piece, square.
+uint64_t zobristCastling[16];     // Indexed by the castling rights mask.
+uint64_t zobristEnPassant[8];     // Indexed by file.
+uint64_t zobristSide;             // Present when black is to move.
+
+void initZobrist()
+{
+    PRNG rng(1070372);
+    for (Color color : { WHITE, BLACK })
+        for (int piece = PAWN; piece <= KING; piece++)
+            for (int sq = 0; sq < 64; sq++)
+                zobristPieces[color][piece][sq] = rng.rand64();
+    for (int rights = 0; rights < 16; rights++)
+        zobristCastling[rights] = rng.rand64();
+    for (int file = 0; file < 8; file++)
+        zobristEnPassant[file] = rng.rand64();
+    zobristSide = rng.rand64();
+}
+
+// --- Piece-Square Tables ---
+// Midgame and endgame value of each piece on each square, material included,
+// from White's side with a8 first (Black reads them mirrored). ChessBoard
+// keeps the running sum in putPiece/removePiece/movePiece, so castling, en
+// passant and promotions are covered by the same three updates.
+
+// A midgame and an endgame value, blended by game phase when evaluating.
+struct Score
+{
+    int mg = 0, eg = 0;
+
+    Score() = default;
+    Score(int midgame, int endgame) : mg(midgame), eg(endgame) {}
+
+    Score &operator+=(Score other)
+    {
+        mg += other.mg;
+        eg += other.eg;
+        return *this;
+    }
+
+    Score &operator-=(Score other)
+    {
+        mg -= other.mg;
+        eg -= other.eg;
+        return *this;
+    }
+
+    Score operator-() const
+    {
+        return Score(-mg, -eg);
+    }
+};
+
+const int pieceValueMg[7] = { 0, 82, 337, 365, 477, 1025, 0 };
+const int pieceValueEg[7] = { 0, 94, 281, 297, 512, 936, 0 };
+const int phaseWeight[7] = { 0, 0, 1, 1, 2, 4, 0 }; // Full board = 24.
+const int MAX_PHASE = 24;
+
+const int pstMgBase[7][64] = {
+    {},
+    { // Pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+         98, 134,  61,  95,  68, 126,  34, -11,
+         -6,   7,  26,  31,  65,  56,  25, -20,
+        -14,  13,   6,  21,  23,  12,  17, -23,
+        -27,  -2,  -5,  12,  17,   6,  10, -25,
+        -26,  -4,  -4, -10,   3,   3,  33, -12,
+        -35,  -1, -20, -23, -15,  24,  38, -22,
+          0,   0,   0,   0,   0,   0,   0,   0 },
+    { // Knight
+       -167, -89, -34, -49,  61, -97, -15,-107,
+        -73, -41,  72,  36,  23,  62,   7, -17,
+        -47,  60,  37,  65,  84, 129,  73,  44,
+         -9,  17,  19,  53,  37,  69,  18,  22,
+        -13,   4,  16,  13,  28,  19,  21,  -8,
+        -23,  -9,  12,  10,  19,  17,  25, -16,
+        -29, -53, -12,  -3,  -1,  18, -14, -19,
+       -105, -21, -58, -33, -17, -28, -19, -23 },
+    { // Bishop
+        -29,   4, -82, -37, -25, -42,   7,  -8,
+        -26,  16, -18, -13,  30,  59,  18, -47,
+        -16,  37,  43,  40,  35,  50,  37,  -2,
+         -4,   5,  19,  50,  37,  37,   7,  -2,
+         -6,  13,  13,  26,  34,  12,  10,   4,
+          0,  15,  15,  15,  14,  27,  18,  10,
+          4,  15,  16,   0,   7,  21,  33,   1,
+        -33,  -3, -14, -21, -13, -12, -39, -21 },
+    { // Rook
+         32,  42,  32,  51,  63,   9,  31,  43,
+         27,  32,  58,  62,  80,  67,  26,  44,
+         -5,  19,  26,  36,  17,  45,  61,  16,
+        -24, -11,   7,  26,  24,  35,  -8, -20,
+        -36, -26, -12,  -1,   9,  -7,   6, -23,
+        -45, -25, -16, -17,   3,   0,  -5, -33,
+        -44, -16, -20,  -9,  -1,  11,  -6, -71,
+        -19, -13,   1,  17,  16,   7, -37, -26 },
+    { // Queen
+        -28,   0,  29,  12,  59,  44,  43,  45,
+        -24, -39,  -5,   1, -16,  57,  28,  54,
+        -13, -17,   7,   8,  29,  56,  47,  57,
+        -27, -27, -16, -16,  -1,  17,  -2,   1,
+         -9, -26,  -9, -10,  -2,  -4,   3,  -3,
+        -14,   2, -11,  -2,  -5,   2,  14,   5,
+        -35,  -8,  11,   2,   8,  15,  -3,   1,
+         -1, -18,  -9,  10, -15, -25, -31, -50 },
+    { // King
+        -65,  23,  16, -15, -56, -34,   2,  13,
+         29,  -1, -20,  -7,  -8,  -4, -38, -29,
+         -9,  24,   2, -16, -20,   6,  22, -22,
+        -17, -20, -12, -27, -30, -25, -14, -36,
+        -49,  -1, -27, -39, -46, -44, -33, -51,
+        -14, -14, -22, -46, -44, -30, -15, -27,
+          1,   7,  -8, -64, -43, -16,   9,   8,
+        -15,  36,  12, -54,   8, -28,  24,  14 },
+};
+
+const int pstEgBase[7][64] = {
+    {},
+    { // Pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+        178, 173, 158, 134, 147, 132, 165, 187,
+         94, 100,  85,  67,  56,  53,  82,  84,
+         32,  24,  13,   5,  -2,   4,  17,  17,
+         13,   9,  -3,  -7,  -7,  -8,   3,  -1,
+          4,   7,  -6,   1,   0,  -5,  -1,  -8,
+         13,   8,   8,  10,  13,   0,   2,  -7,
+          0,   0,   0,   0,   0,   0,   0,   0 },
+    { // Knight
+        -58, -38, -13, -28, -31, -27, -63, -99,
+        -25,  -8, -25,  -2,  -9, -25, -24, -52,
+        -24, -20,  10,   9,  -1,  -9, -19, -41,
+        -17,   3,  22,  22,  22,  11,   8, -18,
+        -18,  -6,  16,  25,  16,  17,   4, -18,
+        -23,  -3,  -1,  15,  10,  -3, -20, -22,
+        -42, -20, -10,  -5,  -2, -20, -23, -44,
+        -29, -51, -23, -15, -22, -18, -50, -64 },
+    { // Bishop
+        -14, -21, -11,  -8,  -7,  -9, -17, -24,
+         -8,  -4,   7, -12,  -3, -13,  -4, -14,
+          2,  -8,   0,  -1,  -2,   6,   0,   4,
+         -3,   9,  12,   9,  14,  10,   3,   2,
+         -6,   3,  13,  19,   7,  10,  -3,  -9,
+        -12,  -3,   8,  10,  13,   3,  -7, -15,
+        -14, -18,  -7,  -1,   4,  -9, -15, -27,
+        -23,  -9, -23,  -5,  -9, -16,  -5, -17 },
+    { // Rook
+         13,  10,  18,  15,  12,  12,   8,   5,
+         11,  13,  13,  11,  -3,   3,   8,   3,
+          7,   7,   7,   5,   4,  -3,  -5,  -3,
+          4,   3,  13,   1,   2,   1,  -1,   2,
+          3,   5,   8,   4,  -5,  -6,  -8, -11,
+         -4,   0,  -5,  -1,  -7, -12,  -8, -16,
+         -6,  -6,   0,   2,  -9,  -9, -11,  -3,
+         -9,   2,   3,  -1,  -5, -13,   4, -20 },
+    { // Queen
+         -9,  22,  22,  27,  27,  19,  10,  20,
+        -17,  20,  32,  41,  58,  25,  30,   0,
+        -20,   6,   9,  49,  47,  35,  19,   9,
+          3,  22,  24,  45,  57,  40,  57,  36,
+        -18,  28,  19,  47,  31,  34,  39,  23,
+        -16, -27,  15,   6,   9,  17,  10,   5,
+        -22, -23, -30, -16, -16, -23, -36, -32,
+        -33, -28, -22, -43,  -5, -32, -20, -41 },
+    { // King
+        -74, -35, -18, -18, -11,  15,   4, -17,
+        -12,  17,  14,  17,  17,  38,  23,  11,
+         10,  17,  23,  15,  20,  45,  44,  13,
+         -8,  22,  24,  27,  26,  33,  26,   3,
+        -18,  -4,  21,  24,  27,  23,   9, -11,
+        -19,  -3,  11,  21,  23,  16,   7,  -9,
+        -27, -11,   4,  13,  14,   4,  -5, -17,
+        -53, -34, -21, -11, -28, -14, -24, -43 },
+};
+
+Score psqTable[3][7][64]; // Indexed by Color, Piece, square; Black negated.
+
+void initPsqt()
+{
+    for (int piece = PAWN; piece <= KING; piece++)
+        for (int sq = 0; sq < 64; sq++)
+        {
+            Score white(pieceValueMg[piece] + pstMgBase[piece][sq], pieceValueEg[piece] + pstEgBase[piece][sq]);
+            psqTable[WHITE][piece][sq] = white;
+            psqTable[BLACK][piece][sq ^ 56] = -white;
+        }
+}
+
+// A piece that a move took off `from` and/or put on `to` (-1 when absent).
+// Recorded so the NNUE accumulators can be brought up to date lazily.
+struct DirtyPiece
+{
+    Piece piece;
+    Color color;
+    int8_t from, to;
+};
+
+// Everything applyMove overwrites that undoMove cannot recompute from the move.
+// The saved keys double as the hash history used for repetition detection.
+struct UndoInfo
+{
+    DirtyPiece dirty[3]; // Pieces the move changed; at most three (promotion with capture).
+    int dirtyCount;
+    Square captured;
+    pair<int, int> enPassantTarget;
+    bool whiteKingMoved, blackKingMoved;
+    bool whiteRookAMoved, whiteRookHMoved;
+    bool blackRookAMoved, blackRookHMoved;
+    int halfmoveClock;
+    uint64_t key;
+    uint64_t pawnKey;
 };
 
 class ChessBoard
 {
 private:
-    vector<vector<Square>> board;
+    Square board[8][8];
+    Bitboards bb;
     vector<Move> moveHistory;
+    vector<UndoInfo> undoStack; // One entry per move in moveHistory.
+    Color sideToMove;
     pair<int, int> enPassantTarget; // (-1,-1) when none
+    int halfmoveClock;              // Plies since the last capture or pawn move.
+    int fullmoveNumber;             // Starts at 1, incremented after Black moves.
+    uint64_t key;                   // Zobrist key of the whole position.
+    uint64_t pawnKey;               // Zobrist key of the pawns alone.
+    Score psq;                      // Sum of psqTable over all pieces.
+    int phase;                      // Sum of phaseWeight over all pieces.
+
+    // Castling rights flags.
+    bool whiteKingMoved, blackKingMoved;
+    bool whiteRookAMoved, whiteRookHMoved;
+    bool blackRookAMoved, blackRookHMoved;
+
+    // --- Board Updates ---
+    // Every change to the position goes through these so that the mailbox, the
+    // bitboards, the piece terms of the Zobrist keys and the piece-square sum
+    // never disagree.
+    void putPiece(int sq, Piece piece, Color color)
+    {
+        uint64_t bit = squareBit(sq);
+        board[sq / 8][sq % 8] = Square(piece, color);
+        bb.pieces(piece, color) |= bit;
+        bb.occupancy(color) |= bit;
+        bb.allPieces |= bit;
+        key ^= zobristPieces[color][piece][sq];
+        if (piece == PAWN)
+            pawnKey ^= zobristPieces[color][piece][sq];
+        psq += psqTable[color][piece][sq];
+        phase += phaseWeight[piece];
+    }
+
+    void removePiece(int sq)
+    {
+        Square &square = board[sq / 8][sq % 8];
+        if (square.piece == EMPTY)
+            return;
+        uint64_t bit = squareBit(sq);
+        bb.pieces(square.piece, square.color) &= ~bit;
+        bb.occupancy(square.color) &= ~bit;
+        bb.allPieces &= ~bit;
+        key ^= zobristPieces[square.color][square.piece][sq];
+        if (square.piece == PAWN)
+            pawnKey ^= zobristPieces[square.color][square.piece][sq];
+        psq -= psqTable[square.color][square.piece][sq];
+        phase -= phaseWeight[square.piece];
+        square = Square();
+    }
+
+    void movePiece(int from, int to)
+    {
+        Square &square = board[from / 8][from % 8];
+        uint64_t fromTo = squareBit(from) | squareBit(to);
+        uint64_t keyChange = zobristPieces[square.color][square.piece][from] ^
+                             zobristPieces[square.color][square.piece][to];
+        bb.pieces(square.piece, square.color) ^= fromTo;
+        bb.occupancy(square.color) ^= fromTo;
+        bb.allPieces ^= fromTo;
+        key ^= keyChange;
+        if (square.piece == PAWN)
+            pawnKey ^= keyChange;
+        psq -= psqTable[square.color][square.piece][from];
+        psq += psqTable[square.color][square.piece][to];
+        board[to / 8][to % 8] = square;
+        square = Square();
+    }
+
+    // Saves the state a move is about to overwrite.
+    UndoInfo &pushUndo(Move move, Square captured)
+    {
+        UndoInfo undo;
+        undo.dirtyCount = 0;
+        undo.captured = captured;
+        undo.enPassantTarget = enPassantTarget;
+        undo.whiteKingMoved = whiteKingMoved;
+        undo.blackKingMoved = blackKingMoved;
+        undo.whiteRookAMoved = whiteRookAMoved;
+        undo.whiteRookHMoved = whiteRookHMoved;
+        undo.blackRookAMoved = blackRookAMoved;
+        undo.blackRookHMoved = blackRookHMoved;
+        undo.halfmoveClock = halfmoveClock;
+        undo.key = key;
+        undo.pawnKey = pawnKey;
+        undoStack.push_back(undo);
+        moveHistory.push_back(move);
+        return undoStack.back();
+    }
+
+    // Restores everything but the pieces from the last undo record and drops it.
+    void popUndo()
+    {
+        const UndoInfo &undo = undoStack.back();
+        enPassantTarget = undo.enPassantTarget;
+        whiteKingMoved = undo.whiteKingMoved;
+        blackKingMoved = undo.blackKingMoved;
+        whiteRookAMoved = undo.whiteRookAMoved;
+        whiteRookHMoved = undo.whiteRookHMoved;
+        blackRookAMoved = undo.blackRookAMoved;
+        blackRookHMoved = undo.blackRookHMoved;
+        halfmoveClock = undo.halfmoveClock;
+        key = undo.key;
+        pawnKey = undo.pawnKey;
+        undoStack.pop_back();
+        moveHistory.pop_back();
+    }
+
+    // Castling rights as a mask: 1 = white kingside, 2 = white queenside,
+    // 4 = black kingside, 8 = black queenside.
+    int castlingRights() const
+    {
+        return (!whiteKingMoved && !whiteRookHMoved ? 1 : 0) | (!whiteKingMoved && !whiteRookAMoved ? 2 : 0) |
+               (!blackKingMoved && !blackRookHMoved ? 4 : 0) | (!blackKingMoved && !blackRookAMoved ? 8 : 0);
+    }
+
+    // The en passant file only enters the key when a pawn can actually capture,
+    // so a double push nobody can take does not make the position look new.
+    uint64_t enPassantKey() const
+    {
+        if (enPassantTarget.first == -1)
+            return 0;
+        int epSq = squareIndex(enPassantTarget.first, enPassantTarget.second);
+        Color capturer = (enPassantTarget.first == 2) ? WHITE : BLACK;
+        Color pushed = (capturer == WHITE) ? BLACK : WHITE;
+        return (pawnAttacks[pushed][epSq] & bb.pieces(PAWN, capturer)) ? zobristEnPassant[enPassantTarget.second] : 0;
+    }
+
+    // The non-piece terms of the key; piece terms are maintained by the board updates above.
+    uint64_t stateKey() const
+    {
+        return zobristCastling[castlingRights()] ^ enPassantKey() ^ (sideToMove == BLACK ? zobristSide : 0);
+    }
+
+    void addMoves(MoveList &moves, int from, uint64_t targets) const
+    {
+        while (targets)
+            moves.add(Move(from, popLsb(targets)));
+    }
+
+public:
+    ChessBoard()
+    {
+        // Reserve up front so making and unmaking moves never allocates.
+        moveHistory.reserve(256);
+        undoStack.reserve(256);
+        clearBoard();
+        initializeBoard();
+        key ^= stateKey();
+    }
+
+    void clearBoard()
+    {
+        for (int sq = 0; sq < 64; sq++)
+            board[sq / 8][sq % 8] = Square();
+        bb = Bitboards();
+        moveHistory.clear();
+        undoStack.clear();
+        sideToMove = WHITE;
+        enPassantTarget = { -1, -1 };
+        halfmoveClock = 0;
+        fullmoveNumber = 1;
+        key = pawnKey = 0;
+        psq = Score();
+        phase = 0;
+        whiteKingMoved = blackKingMoved = false;
+        whiteRookAMoved = whiteRookHMoved = false;
+        blackRookAMoved = blackRookHMoved = false;
+    }
+
+    // --- FEN Setup ---
+    // Loads piece placement, side to move, castling rights (mapped onto the
+    // king/rook moved flags), the en passant square and the move clocks, which
+    // default to 0 and 1 when absent (as in EPD). Rights whose king or rook is
+    // off its home square are dropped. Returns false and leaves the board
+    // untouched on malformed input.
+    bool loadFen(const string &fen)
+    {
+        istringstream iss(fen);
+        string placement, side = "w", castling = "-", ep = "-";
+        int halfmove = 0, fullmove = 1;
+        if (!(iss >> placement))
+            return false;
+        iss >> side >> castling >> ep;
+        if (!(iss >> halfmove >> fullmove))
+        {
+            halfmove = 0;
+            fullmove = 1;
+        }
+
+        ChessBoard next;
+        next.clearBoard();
+        int row = 0, col = 0;
+        for (char c : placement)
+        {
+            if (c == '/')
+            {
+                if (col != 8 || ++row > 7)
+                    return false;
+                col = 0;
+            }
+            else if (c >= '1' && c <= '8')
+                col += c - '0';
+            else
+            {
+                const string pieceChars = "PNBRQK";
+                size_t idx = pieceChars.find(toupper(c));
+                if (idx == string::npos || col > 7)
+                    return false;
+                next.putPiece(squareIndex(row, col), Piece(idx + 1), isupper(c) ? WHITE : BLACK);
+                col++;
+            }
+            if (col > 8)
+                return false;
+        }
+        if (row != 7 || col != 8 || (side != "w" && side != "b"))
+            return false;
+        // Move generation assumes exactly one king per side and no pawn on the
+        // first or last rank.
+        if (popCount(next.bb.whiteKing) != 1 || popCount(next.bb.blackKing) != 1 ||
+            ((next.bb.whitePawns | next.bb.blackPawns) & 0xFF000000000000FFULL))
+            return false;
+
+        next.sideToMove = (side == "w") ? WHITE : BLACK;
+        // The side that just moved cannot have left its king in check; move
+        // generation would capture it.
+        if (next.checkers(next.sideToMove == WHITE ? BLACK : WHITE))
+            return false;
+        auto has = [&](int checkRow, int checkCol, Piece piece, Color color) {
+            return next.board[checkRow][checkCol].piece == piece && next.board[checkRow][checkCol].color == color;
+        };
+        bool whiteKingHome = has(7, 4, KING, WHITE), blackKingHome = has(0, 4, KING, BLACK);
+        bool K = castling.find('K') != string::npos && whiteKingHome && has(7, 7, ROOK, WHITE);
+        bool Q = castling.find('Q') != string::npos && whiteKingHome && has(7, 0, ROOK, WHITE);
+        bool k = castling.find('k') != string::npos && blackKingHome && has(0, 7, ROOK, BLACK);
+        bool q = castling.find('q') != string::npos && blackKingHome && has(0, 0, ROOK, BLACK);
+        next.whiteKingMoved = !K && !Q;
+        next.whiteRookHMoved = !K;
+        next.whiteRookAMoved = !Q;
+        next.blackKingMoved = !k && !q;
+        next.blackRookHMoved = !k;
+        next.blackRookAMoved = !q;
+        // The target is kept only if a pawn just double-pushed past it: the
+        // enemy pawn stands beyond it and its path back is empty. Otherwise the
+        // field is read as "-".
+        if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && ep[1] == (next.sideToMove == WHITE ? '6' : '3'))
+        {
+            int epRow = '8' - ep[1], epCol = ep[0] - 'a', forward = next.sideToMove == WHITE ? 1 : -1;
+            Color pushed = next.sideToMove == WHITE ? BLACK : WHITE;
+            if (has(epRow + forward, epCol, PAWN, pushed) && next.board[epRow][epCol].piece == EMPTY &&
+                next.board[epRow - forward][epCol].piece == EMPTY)
+                next.enPassantTarget = { epRow, epCol };
+        }
+        next.halfmoveClock = max(halfmove, 0);
+        next.fullmoveNumber = max(fullmove, 1);
+        next.key ^= next.stateKey();
+        *this = next;
+        return true;
+    }
+
+    // The inverse of loadFen. The en passant square is written after every
+    // double pawn push, whether or not a capture is possible.
+    string toFen() const
+    {
+        string fen;
+        for (int row = 0; row < 8; row++)
+        {
+            int empty = 0;
+            for (int col = 0; col < 8; col++)
+            {
+                const Square &square = board[row][col];
+                if (square.piece == EMPTY)
+                {
+                    empty++;
+                    continue;
+                }
+                if (empty)
+                    fen += char('0' + empty);
+                empty = 0;
+                char c = "PNBRQK"[square.piece - 1];
+                fen += square.color == WHITE ? c : char(tolower(c));
+            }
+            if (empty)
+                fen += char('0' + empty);
+            if (row < 7)
+                fen += '/';
+        }
+        fen += sideToMove == WHITE ? " w " : " b ";
+        int rights = castlingRights();
+        string castling;
+        for (int i = 0; i < 4; i++)
+            if (rights & (1 << i))
+                castling += "KQkq"[i];
+        fen += castling.empty() ? "-" : castling;
+        fen += " ";
+        if (enPassantTarget.first >= 0)
+            fen += string(1, char('a' + enPassantTarget.second)) + char('8' - enPassantTarget.first);
+        else
+            fen += "-";
+        fen += " " + to_string(halfmoveClock) + " " + to_string(fullmoveNumber);
+        return fen;
+    }
+
+    Color getSideToMove() const
+    {
+        return sideToMove;
+    }
+
+    uint64_t getKey() const
+    {
+        return key;
+    }
+
+    uint64_t getPawnKey() const
+    {
+        return pawnKey;
+    }
+
+    int getHalfmoveClock() const
+    {
+        return halfmoveClock;
+    }
+
+    int getCastlingRights() const
+    {
+        return castlingRights();
+    }
+
+    pair<int, int> getEnPassantTarget() const
+    {
+        return enPassantTarget;
+    }
+
+    int getFullmoveNumber() const
+    {
+        return fullmoveNumber;
+    }
+
+    // Material plus piece-square values, White minus Black.
+    Score getPsq() const
+    {
+        return psq;
+    }
+
+    // MAX_PHASE with all pieces on the board, falling to 0 with only pawns and kings.
+    int getPhase() const
+    {
+        return min(phase, MAX_PHASE);
+    }
+
+    // Number of moves (null moves included) played since the position was set up.
+    int gamePly() const
+    {
+        return undoStack.size();
+    }
+
+    // Key of the position after the first ply moves, for 0 <= ply <= gamePly().
+    uint64_t keyAt(int ply) const
+    {
+        return ply == (int)undoStack.size() ? key : undoStack[ply].key;
+    }
+
+    // The pieces changed by the move that led to the position at ply (>= 1).
+    const UndoInfo &undoAt(int ply) const
+    {
+        return undoStack[ply - 1];
+    }
+
+    // The move that led here (Move::none() after a null move or at the start).
+    Move lastMove() const
+    {
+        return moveHistory.empty() ? Move::none() : moveHistory.back();
+    }
+
+    // True if the current position already occurred since the last capture or
+    // pawn move. Only positions with the same side to move can match, so the
+    // hash history is stepped back two plies at a time, one comparison each.
+    bool isRepetition() const
+    {
+        int plies = undoStack.size();
+        int limit = min(halfmoveClock, plies);
+        for (int i = 4; i <= limit; i += 2)
+            if (undoStack[plies - i].key == key)
+                return true;
+        return false;
+    }
+
+    // Recomputes the key from scratch; used to check the incremental updates.
+    uint64_t computeKey() const
+    {
+        uint64_t fresh = stateKey();
+        for (int sq = 0; sq < 64; sq++)
+            if (pieceAt(sq).piece != EMPTY)
+                fresh ^= zobristPieces[pieceAt(sq).color][pieceAt(sq).piece][sq];
+        return fresh;
+    }
+
+    void initializeBoard()
+    {
+        // Initialize pawns.
+        for (int i = 0; i < 8; i++)
+        {
+            putPiece(squareIndex(1, i), PAWN, BLACK);
+            putPiece(squareIndex(6, i), PAWN, WHITE);
+        }
+        // Black pieces.
+        Piece backRank[8] = { ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK };
+        for (int i = 0; i < 8; i++)
+            putPiece(squareIndex(0, i), backRank[i], BLACK);
+        // White pieces.
+        for (int i = 0; i < 8; i++)
+            putPiece(squareIndex(7, i), backRank[i], WHITE);
+    }
+
+    // A helper to let us access a square (used in user input processing).
+    Square getSquare(int row, int col) const
+    {
+        return board[row][col];
+    }
+
+    const Square &pieceAt(int sq) const
+    {
+        return board[sq / 8][sq % 8];
+    }
+
+    void printBoard()
+    {
+        cout << "\n  0 1 2 3 4 5 6 7\n";
+        for (int row = 0; row < 8; row++)
+        {
+            cout << row << " ";
+            for (int col = 0; col < 8; col++)
+            {
+                char pieceChar = '.';
+                if (board[row][col].piece != EMPTY)
+                    pieceChar = getPieceChar(board[row][col]);
+                cout << pieceChar << " ";
+            }
+            cout << endl;
+        }
+    }
+
+    char getPieceChar(const Square &square) const
+    {
+        char pieceChar = '.';
+        switch (square.piece)
+        {
+        case PAWN:
+            pieceChar = 'P';
+            break;
+        case KNIGHT:
+            pieceChar = 'N';
+            break;
+        case BISHOP:
+            pieceChar = 'B';
+            break;
+        case ROOK:
+            pieceChar = 'R';
+            break;
+        case QUEEN:
+            pieceChar = 'Q';
+            break;
+        case KING:
+            pieceChar = 'K';
+            break;
+        default:
+            pieceChar = '.';
+            break;
+        }
+        return square.color == BLACK ? tolower(pieceChar) : pieceChar;
+    }
+
+    // --- Move Generation Functions ---
+    // Each generator only emits destinations in `allowed`, which the legal
+    // generator narrows to the check-evasion mask and, for a pinned piece, to
+    // the line through its king. The side to move and the GenType are template
+    // parameters, so the color tests and the move-kind filters are resolved at
+    // compile time and every instantiation runs straight-line code.
+
+    template <Color Us, GenType Type>
+    void generatePawnMoves(MoveList &moves, int from, uint64_t allowed) const
+    {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+        constexpr int Up = Us == WHITE ? -8 : 8;
+        constexpr int StartRow = Us == WHITE ? 6 : 1;
+        constexpr int PromotionRow = Us == WHITE ? 0 : 7;
+        int ahead = from + Up;
+        bool isPromotion = ahead / 8 == PromotionRow;
+        if (!(bb.allPieces & squareBit(ahead)))
+        {
+            if (isPromotion)
+            {
+                if (Type != QUIETS && (allowed & squareBit(ahead)))
+                    addPromotions(moves, from, ahead);
+            }
+            else if (Type != CAPTURES)
+            {
+                if (allowed & squareBit(ahead))
+                    moves.add(Move(from, ahead));
+                int doubleAhead = ahead + Up;
+                if (from / 8 == StartRow && !(bb.allPieces & squareBit(doubleAhead)) && (allowed & squareBit(doubleAhead)))
+                    moves.add(Move(from, doubleAhead));
+            }
+        }
+        if (Type == QUIETS)
+            return;
+        uint64_t captures = pawnAttacks[Us][from] & bb.occupancy(Them) & allowed;
+        while (captures)
+        {
+            int to = popLsb(captures);
+            if (isPromotion)
+                addPromotions(moves, from, to);
+            else
+                moves.add(Move(from, to));
+        }
+    }
+
+    void addPromotions(MoveList &moves, int from, int to) const
+    {
+        moves.add(Move(from, to, PROMOTION, QUEEN));
+        moves.add(Move(from, to, PROMOTION, ROOK));
+        moves.add(Move(from, to, PROMOTION, BISHOP));
+        moves.add(Move(from, to, PROMOTION, KNIGHT));
+    }
+
+    // En passant removes two pawns from one rank (or a pawn from a diagonal), which
+    // can expose the king in ways neither the pin nor the check mask describes, so
+    // each candidate is tested against the occupancy it would leave behind.
+    template <Color Us>
+    void generateEnPassantMoves(MoveList &moves, int kingSq) const
+    {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+        if (enPassantTarget.first == -1)
+            return;
+        int to = squareIndex(enPassantTarget.first, enPassantTarget.second);
+        int capturedSq = to + (Us == WHITE ? 8 : -8);
+        uint64_t candidates = pawnAttacks[Them][to] & bb.pieces(PAWN, Us);
+        while (candidates)
+        {
+            int from = popLsb(candidates);
+            uint64_t occupied = (bb.allPieces ^ squareBit(from) ^ squareBit(capturedSq)) | squareBit(to);
+            if (!(attackersTo(kingSq, occupied) & bb.occupancy(Them) & ~squareBit(capturedSq)))
+                moves.add(Move(from, to, EN_PASSANT));
+        }
+    }
+
+    void generateKnightMoves(MoveList &moves, int from, uint64_t allowed) const
+    {
+        addMoves(moves, from, knightAttacks[from] & allowed);
+    }
+
+    void generateBishopMoves(MoveList &moves, int from, uint64_t allowed) const
+    {
+        addMoves(moves, from, bishopAttacks(from, bb.allPieces) & allowed);
+    }
+
+    void generateRookMoves(MoveList &moves, int from, uint64_t allowed) const
+    {
+        addMoves(moves, from, rookAttacks(from, bb.allPieces) & allowed);
+    }
+
+    void generateQueenMoves(MoveList &moves, int from, uint64_t allowed) const
+    {
+        addMoves(moves, from, queenAttacks(from, bb.allPieces) & allowed);
+    }
+
+    // Castling is only generated for ALL_MOVES and QUIETS, and not in check.
+    template <Color Us, GenType Type>
+    void generateKingMoves(MoveList &moves, int from, bool inCheck) const
+    {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+        // Test each step with the king lifted off the board, so a square further
+        // along a checking slider's ray is not mistaken for a safe one.
+        uint64_t occupied = bb.allPieces ^ squareBit(from);
+        uint64_t targets = kingAttacks[from] & (Type == CAPTURES ? bb.occupancy(Them)
+                                                : Type == QUIETS ? ~bb.allPieces
+                                                                 : ~bb.occupancy(Us));
+        while (targets)
+        {
+            int to = popLsb(targets);
+            if (!(attackersTo(to, occupied) & bb.occupancy(Them)))
+                moves.add(Move(from, to));
+        }
+        if (Type == CAPTURES || Type == EVASIONS || inCheck)
+            return;
+        // --- Castling ---
+        // The squares between king and rook (f/g and b/c/d) must be empty, and
+        // the king may not pass through or land on an attacked square.
+        constexpr int Row = Us == WHITE ? 7 : 0;
+        constexpr uint64_t Kingside = 3ULL << (Row * 8 + 5);
+        constexpr uint64_t Queenside = 7ULL << (Row * 8 + 1);
+        bool kingMoved = Us == WHITE ? whiteKingMoved : blackKingMoved;
+        bool rookHMoved = Us == WHITE ? whiteRookHMoved : blackRookHMoved;
+        bool rookAMoved = Us == WHITE ? whiteRookAMoved : blackRookAMoved;
+        if (kingMoved || from != squareIndex(Row, 4))
+            return;
+        if (!rookHMoved && !(bb.allPieces & Kingside) && !isSquareAttacked(Row, 5, Them) && !isSquareAttacked(Row, 6, Them))
+            moves.add(Move(from, squareIndex(Row, 6), CASTLING));
+        if (!rookAMoved && !(bb.allPieces & Queenside) && !isSquareAttacked(Row, 3, Them) && !isSquareAttacked(Row, 2, Them))
+            moves.add(Move(from, squareIndex(Row, 2), CASTLING));
+    }
+
+    // --- Helpers for Move Legality Checks ---
+    // Looks outward from the target square: a piece attacks sq exactly when the
+    // same kind of piece standing on sq would attack it back (pawns use the
+    // opposite color's pattern). The occupancy is a parameter so callers can
+    // look through pieces, e.g. a king stepping back along a slider's ray.
+    uint64_t attackersTo(int sq, uint64_t occupied) const
+    {
+        return (pawnAttacks[BLACK][sq] & bb.whitePawns) |
+               (pawnAttacks[WHITE][sq] & bb.blackPawns) |
+               (knightAttacks[sq] & (bb.whiteKnights | bb.blackKnights)) |
+               (kingAttacks[sq] & (bb.whiteKing | bb.blackKing)) |
+               (bishopAttacks(sq, occupied) & (bb.whiteBishops | bb.blackBishops | bb.whiteQueens | bb.blackQueens)) |
+               (rookAttacks(sq, occupied) & (bb.whiteRooks | bb.blackRooks | bb.whiteQueens | bb.blackQueens));
+    }
+
+    uint64_t attackersTo(int sq) const
+    {
+        return attackersTo(sq, bb.allPieces);
+    }
+
+    bool isSquareAttacked(int sq, Color attackerColor) const
+    {
+        Color defender = (attackerColor == WHITE) ? BLACK : WHITE;
+        uint64_t queens = bb.pieces(QUEEN, attackerColor);
+        return (pawnAttacks[defender][sq] & bb.pieces(PAWN, attackerColor)) ||
+               (knightAttacks[sq] & bb.pieces(KNIGHT, attackerColor)) ||
+               (kingAttacks[sq] & bb.pieces(KING, attackerColor)) ||
+               (bishopAttacks(sq, bb.allPieces) & (bb.pieces(BISHOP, attackerColor) | queens)) ||
+               (rookAttacks(sq, bb.allPieces) & (bb.pieces(ROOK, attackerColor) | queens));
+    }
+
+    bool isSquareAttacked(int row, int col, Color attackerColor) const
+    {
+        return isSquareAttacked(squareIndex(row, col), attackerColor);
+    }
+
+    // Enemy pieces giving check to the king of the given color.
+    uint64_t checkers(Color color) const
+    {
+        uint64_t king = bb.pieces(KING, color);
+        Color enemy = (color == WHITE) ? BLACK : WHITE;
+        return king ? attackersTo(lsb(king)) & bb.occupancy(enemy) : 0;
+    }
+
+    bool isKingInCheck(Color color) const
+    {
+        uint64_t king = bb.pieces(KING, color);
+        Color enemy = (color == WHITE) ? BLACK : WHITE;
+        return king && isSquareAttacked(lsb(king), enemy);
+    }
+
+    // --- Move Execution ---
+    void applyMove(Move move)
+    {
+        TELEMETRY_TIME(applyCalls, applyNanos);
+        int from = move.from(), to = move.to();
+        int sr = from / 8, sc = from % 8;
+        int dr = to / 8, dc = to % 8;
+        Square moving = board[sr][sc];
+        bool isCastling = move.type() == CASTLING;
+        bool isEnPassant = move.type() == EN_PASSANT;
+
+        UndoInfo &undo = pushUndo(move, isEnPassant ? board[sr][dc] : board[dr][dc]);
+        auto dirty = [&](Piece piece, Color color, int pieceFrom, int pieceTo) {
+            undo.dirty[undo.dirtyCount++] = { piece, color, int8_t(pieceFrom), int8_t(pieceTo) };
+        };
+        if (isCastling)
+        {
+            dirty(KING, moving.color, from, to);
+            dirty(ROOK, moving.color, squareIndex(dr, dc > sc ? 7 : 0), squareIndex(dr, dc > sc ? dc - 1 : dc + 1));
+        }
+        else
+        {
+            if (undo.captured.piece != EMPTY)
+                dirty(undo.captured.piece, undo.captured.color, isEnPassant ? squareIndex(sr, dc) : to, -1);
+            if (move.type() == PROMOTION)
+            {
+                dirty(PAWN, moving.color, from, -1);
+                dirty(move.promotedPiece(), moving.color, -1, to);
+            }
+            else
+                dirty(moving.piece, moving.color, from, to);
+        }
+
+        // Take out the castling, en passant and side terms; they are added back
+        // for the new state once the move is made.
+        key ^= stateKey();
+        halfmoveClock = (moving.piece == PAWN || undo.captured.piece != EMPTY) ? 0 : halfmoveClock + 1;
+
+        if (isCastling)
+        {
+            movePiece(from, to);
+            if (dc > sc) // Kingside.
+                movePiece(squareIndex(dr, 7), squareIndex(dr, dc - 1));
+            else // Queenside.
+                movePiece(squareIndex(dr, 0), squareIndex(dr, dc + 1));
+        }
+        else
+        {
+            if (isEnPassant)
+                removePiece(squareIndex(sr, dc));
+            if (board[dr][dc].piece != EMPTY)
+                removePiece(to);
+            if (move.type() == PROMOTION)
+            {
+                removePiece(from);
+                putPiece(to, move.promotedPiece(), moving.color);
+            }
+            else
+                movePiece(from, to);
+        }
+        if (moving.piece == PAWN && abs(dr - sr) == 2)
+            enPassantTarget = { (sr + dr) / 2, sc };
+        else
+            enPassantTarget = { -1, -1 };
+
+        if (moving.piece == KING)
+        {
+            if (moving.color == WHITE)
+                whiteKingMoved = true;
+            else
+                blackKingMoved = true;
+        }
+        if (moving.piece == ROOK)
+        {
+            if (moving.color == WHITE)
+            {
+                if (sr == 7 && sc == 0)
+                    whiteRookAMoved = true;
+                if (sr == 7 && sc == 7)
+                    whiteRookHMoved = true;
+            }
+            else
+            {
+                if (sr == 0 && sc == 0)
+                    blackRookAMoved = true;
+                if (sr == 0 && sc == 7)
+                    blackRookHMoved = true;
+            }
+        }
+        // A rook captured on its home square loses its castling right too.
+        if (to == squareIndex(7, 0))
+            whiteRookAMoved = true;
+        if (to == squareIndex(7, 7))
+            whiteRookHMoved = true;
+        if (to == squareIndex(0, 0))
+            blackRookAMoved = true;
+        if (to == squareIndex(0, 7))
+            blackRookHMoved = true;
+
+        if (sideToMove == BLACK)
+            fullmoveNumber++;
+        sideToMove = (sideToMove == WHITE) ? BLACK : WHITE;
+        key ^= stateKey();
+    }
+
+    // Takes back the last move played, which must be the one passed in.
+    void undoMove(Move move)
+    {
+        const UndoInfo &undo = undoStack.back();
+        int from = move.from(), to = move.to();
+        int sr = from / 8, sc = from % 8;
+        int dr = to / 8, dc = to % 8;
+        Color color = board[dr][dc].color;
+
+        if (move.type() == CASTLING)
+        {
+            movePiece(to, from);
+            if (dc > sc) // Kingside.
+                movePiece(squareIndex(dr, dc - 1), squareIndex(dr, 7));
+            else // Queenside.
+                movePiece(squareIndex(dr, dc + 1), squareIndex(dr, 0));
+        }
+        else
+        {
+            if (move.type() == PROMOTION)
+            {
+                removePiece(to);
+                putPiece(from, PAWN, color);
+            }
+            else
+                movePiece(to, from);
+            if (undo.captured.piece != EMPTY)
+            {
+                int capturedSq = (move.type() == EN_PASSANT) ? squareIndex(sr, dc) : to;
+                putPiece(capturedSq, undo.captured.piece, undo.captured.color);
+            }
+        }
+
+        if (color == BLACK)
+            fullmoveNumber--;
+        sideToMove = color;
+        popUndo();
+    }
+
+    // Passes the turn without moving, for null-move pruning. The halfmove clock
+    // restarts so repetition detection never looks back across a null move.
+    void applyNullMove()
+    {
+        pushUndo(Move::none(), Square());
+        key ^= stateKey();
+        enPassantTarget = { -1, -1 };
+        halfmoveClock = 0;
+        sideToMove = (sideToMove == WHITE) ? BLACK : WHITE;
+        key ^= stateKey();
+    }
+
+    void undoNullMove()
+    {
+        sideToMove = (sideToMove == WHITE) ? BLACK : WHITE;
+        popUndo();
+    }
+
+    // Own pieces that are the only blocker between the king and an enemy slider.
+    uint64_t pinnedPieces(Color color, int kingSq) const
+    {
+        Color enemy = (color == WHITE) ? BLACK : WHITE;
+        uint64_t queens = bb.pieces(QUEEN, enemy);
+        uint64_t snipers = (rookAttacks(kingSq, 0) & (bb.pieces(ROOK, enemy) | queens)) |
+                           (bishopAttacks(kingSq, 0) & (bb.pieces(BISHOP, enemy) | queens));
+        uint64_t pinned = 0;
+        while (snipers)
+        {
+            uint64_t blockers = betweenBB[kingSq][popLsb(snipers)] & bb.allPieces;
+            if (blockers && !(blockers & (blockers - 1)))
+                pinned |= blockers & bb.occupancy(color);
+        }
+        return pinned;
+    }
+
+    // Generates exactly the legal moves of the given GenType. Checkers, pinned
+    // pieces and the squares that resolve a single check are computed once;
+    // every destination is then filtered by them, so no move is made on the
+    // board to test it. ALL_MOVES in check is generated as EVASIONS.
+    MoveList getLegalMoves(Color color, GenType type = ALL_MOVES) const
+    {
+        TELEMETRY_TIME(movegenCalls, movegenNanos);
+        MoveList moves;
+        uint64_t checking = checkers(color);
+        if (type == ALL_MOVES && checking)
+            type = EVASIONS;
+        if (color == WHITE)
+            generateLegal<WHITE>(moves, type, checking);
+        else
+            generateLegal<BLACK>(moves, type, checking);
+        return moves;
+    }
+
+    template <Color Us>
+    void generateLegal(MoveList &moves, GenType type, uint64_t checking) const
+    {
+        switch (type)
+        {
+        case ALL_MOVES:
+            generateLegal<Us, ALL_MOVES>(moves, checking);
+            break;
+        case CAPTURES:
+            generateLegal<Us, CAPTURES>(moves, checking);
+            break;
+        case QUIETS:
+            generateLegal<Us, QUIETS>(moves, checking);
+            break;
+        case EVASIONS:
+            generateLegal<Us, EVASIONS>(moves, checking);
+            break;
+        }
+    }
+
+    template <Color Us, GenType Type>
+    void generateLegal(MoveList &moves, uint64_t checking) const
+    {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+        int kingSq = lsb(bb.pieces(KING, Us));
+        generateKingMoves<Us, Type>(moves, kingSq, checking != 0);
+        // In double check only the king can move.
+        if (checking & (checking - 1))
+            return;
+
+        // Outside check anything goes; in check a move must capture the checker
+        // or block its ray.
+        uint64_t checkMask = checking ? (betweenBB[kingSq][lsb(checking)] | checking) : ~0ULL;
+        uint64_t pawnAllowed = ~bb.occupancy(Us) & checkMask;
+        uint64_t allowed = pawnAllowed & (Type == CAPTURES ? bb.occupancy(Them) : Type == QUIETS ? ~bb.allPieces : ~0ULL);
+        uint64_t pinned = pinnedPieces(Us, kingSq);
+        uint64_t pieces;
+
+        pieces = bb.pieces(PAWN, Us);
+        while (pieces)
+        {
+            int from = popLsb(pieces);
+            uint64_t pinRay = (pinned & squareBit(from)) ? lineBB[kingSq][from] : ~0ULL;
+            generatePawnMoves<Us, Type>(moves, from, pawnAllowed & pinRay);
+        }
+        if (Type != QUIETS)
+            generateEnPassantMoves<Us>(moves, kingSq);
+        // A pinned knight can never stay on the pin line.
+        pieces = bb.pieces(KNIGHT, Us) & ~pinned;
+        while (pieces)
+            generateKnightMoves(moves, popLsb(pieces), allowed);
+        pieces = bb.pieces(BISHOP, Us);
+        while (pieces)
+        {
+            int from = popLsb(pieces);
+            uint64_t pinRay = (pinned & squareBit(from)) ? lineBB[kingSq][from] : ~0ULL;
+            generateBishopMoves(moves, from, allowed & pinRay);
+        }
+        pieces = bb.pieces(ROOK, Us);
+        while (pieces)
+        {
+            int from = popLsb(pieces);
+            uint64_t pinRay = (pinned & squareBit(from)) ? lineBB[kingSq][from] : ~0ULL;
+            generateRookMoves(moves, from, allowed & pinRay);
+        }
+        pieces = bb.pieces(QUEEN, Us);
+        while (pieces)
+        {
+            int from = popLsb(pieces);
+            uint64_t pinRay = (pinned & squareBit(from)) ? lineBB[kingSq][from] : ~0ULL;
+            generateQueenMoves(moves, from, allowed & pinRay);
+        }
+    }
+
+    // True if the move is legal here, for moves that come from elsewhere (the
+    // hash table, killer slots). Only the moving piece's moves are generated.
+    bool isLegal(Move move) const
+    {
+        return sideToMove == WHITE ? isLegal<WHITE>(move) : isLegal<BLACK>(move);
+    }
+
+    template <Color Us>
+    bool isLegal(Move move) const
+    {
+        int from = move.from();
+        const Square &square = board[from / 8][from % 8];
+        if (move == Move::none() || square.color != Us)
+            return false;
+        MoveList moves;
+        int kingSq = lsb(bb.pieces(KING, Us));
+        uint64_t checking = checkers(Us);
+        if (square.piece == KING)
+            generateKingMoves<Us, ALL_MOVES>(moves, from, checking != 0);
+        else if (!(checking & (checking - 1)))
+        {
+            uint64_t checkMask = checking ? (betweenBB[kingSq][lsb(checking)] | checking) : ~0ULL;
+            uint64_t pinRay = (pinnedPieces(Us, kingSq) & squareBit(from)) ? lineBB[kingSq][from] : ~0ULL;
+            uint64_t allowed = ~bb.occupancy(Us) & checkMask & pinRay;
+            switch (square.piece)
+            {
+            case PAWN:
+                if (move.type() == EN_PASSANT)
+                    generateEnPassantMoves<Us>(moves, kingSq);
+                else
+                    generatePawnMoves<Us, ALL_MOVES>(moves, from, allowed);
+                break;
+            case KNIGHT:
+                if (pinRay == ~0ULL)
+                    generateKnightMoves(moves, from, allowed);
+                break;
+            case BISHOP:
+                generateBishopMoves(moves, from, allowed);
+                break;
+            case ROOK:
+                generateRookMoves(moves, from, allowed);
+                break;
+            case QUEEN:
+                generateQueenMoves(moves, from, allowed);
+                break;
+            default:
+                break;
+            }
+        }
+        for (Move candidate : moves)
+            if (candidate == move)
+                return true;
+        return false;
+    }
+
+    // --- Bitboards ---
+    // Maintained incrementally by applyMove; no rebuild is needed.
+    const Bitboards &getBitboards() const
+    {
+        return bb;
+    }
+};
+
+// --- Transposition Table ---
+// A shared hash table of search results, probed and stored by every search
+// thread without locks. Each entry is two 64-bit words: the packed data and
+// the key XORed with that data. A reader only accepts an entry whose words
+// XOR back to its own key, so an entry torn by two threads writing at once
+// simply reads as a miss. Four entries make one 64-byte, cache-line aligned
+// bucket, and a position only ever looks inside its own bucket.
+
+enum Bound : uint8_t
+{
+    BOUND_NONE,
+    BOUND_UPPER, // Score is at most this (fail low).
+    BOUND_LOWER, // Score is at least this (fail high).
+    BOUND_EXACT
+};
+
+// An unpacked entry, as returned by a probe.
+struct TTData
+{
+    Move move;
+    int score;
+    int eval;
+    int depth;
+    Bound bound;
+};
+
+class TranspositionTable
+{
+private:
+    struct Entry
+    {
+        atomic<uint64_t> keyXorData;
+        atomic<uint64_t> data;
+    };
+
+    struct alignas(64) Bucket
+    {
+        Entry entries[4];
+    };
+
+    Bucket *buckets = nullptr;
+    size_t bucketCount = 0;
+    size_t allocatedBytes = 0;
+    uint8_t generation = 0; // Six bits, bumped once per search to age old entries.
+
+    // Data word layout: move (16) | score (16) | static eval (16) | depth (8) |
+    // bound (2) | generation (6).
+    static uint64_t pack(Move move, int score, int eval, int depth, Bound bound, uint8_t gen)
+    {
+        return uint64_t(move.data) | (uint64_t(uint16_t(int16_t(score))) << 16) |
+               (uint64_t(uint16_t(int16_t(eval))) << 32) | (uint64_t(uint8_t(int8_t(depth))) << 48) |
+               (uint64_t(bound) << 56) | (uint64_t(gen & 63) << 58);
+    }
+
+    static TTData unpack(uint64_t data)
+    {
+        TTData result;
+        result.move = Move(uint16_t(data));
+        result.score = int16_t(data >> 16);
+        result.eval = int16_t(data >> 32);
+        result.depth = int8_t(data >> 48);
+        result.bound = Bound((data >> 56) & 3);
+        return result;
+    }
+
+    static int entryDepth(uint64_t data)
+    {
+        return int8_t(data >> 48);
+    }
+
+    static uint8_t entryGeneration(uint64_t data)
+    {
+        return (data >> 58) & 63;
+    }
+
+    // Maps the key onto [0, bucketCount) with a multiply instead of a modulo,
+    // so the table size does not have to be a power of two.
+    Bucket &bucketFor(uint64_t key) const
+    {
+        return buckets[(size_t)(((unsigned __int128)key * bucketCount) >> 64)];
+    }
+
+    void release()
+    {
+        if (buckets)
+            munmap(buckets, allocatedBytes);
+        buckets = nullptr;
+        bucketCount = allocatedBytes = 0;
+    }
+
+public:
+    TranspositionTable() = default;
+    TranspositionTable(const TranspositionTable &) = delete;
+    TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+    ~TranspositionTable()
+    {
+        release();
+    }
+
+    // Reallocates the table to the given size in megabytes; the new table is empty.
+    // With hugePages set, explicit 2 MB pages are tried first (Linux MAP_HUGETLB,
+    // which needs pages reserved by the administrator); otherwise the kernel is
+    // asked to back the table with transparent huge pages where supported. Huge
+    // pages cut the TLB misses that dominate random probes into a large table.
+    // Returns false if the memory could not be allocated.
+    bool resize(size_t megabytes, bool hugePages = false)
+    {
+        release();
+        const size_t hugePageSize = 2 * 1024 * 1024;
+        size_t bytes = max<size_t>(megabytes, 1) * 1024 * 1024;
+        bytes = (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+
+        void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugePages)
+            memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#else
+        (void)hugePages;
+#endif
+        if (memory == MAP_FAILED)
+        {
+            memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                return false;
+#ifdef MADV_HUGEPAGE
+            madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        // Anonymous mappings are page aligned and already zeroed, i.e. empty.
+        buckets = static_cast<Bucket *>(memory);
+        allocatedBytes = bytes;
+        bucketCount = bytes / sizeof(Bucket);
+        generation = 0;
+        return true;
+    }
+
+    size_t sizeInMegabytes() const
+    {
+        return allocatedBytes / (1024 * 1024);
+    }
+
+    // Zeroes the table, splitting the work across threads since a multi-gigabyte
+    // memset on one core takes seconds.
+    void clear(int threads = 1)
+    {
+        threads = max(threads, 1);
+        vector<thread> workers;
+        size_t chunk = (bucketCount + threads - 1) / threads;
+        for (int i = 0; i < threads; i++)
+        {
+            size_t start = min(bucketCount, i * chunk), end = min(bucketCount, start + chunk);
+            workers.emplace_back([this, start, end]() {
+                memset(static_cast<void *>(buckets + start), 0, (end - start) * sizeof(Bucket));
+            });
+        }
+        for (auto &worker : workers)
+            worker.join();
+        generation = 0;
+    }
+
+    // Called at the start of every search so entries from earlier searches age.
+    void newSearch()
+    {
+        generation = (generation + 1) & 63;
+    }
+
+    bool probe(uint64_t key, TTData &result) const
+    {
+        TELEMETRY_COUNT(ttProbes);
+        Bucket &bucket = bucketFor(key);
+        for (Entry &entry : bucket.entries)
+        {
+            uint64_t data = entry.data.load(memory_order_relaxed);
+            if ((entry.keyXorData.load(memory_order_relaxed) ^ data) == key && data)
+            {
+                result = unpack(data);
+                TELEMETRY_COUNT(ttHits);
+                return true;
+            }
+        }
+#ifdef TELEMETRY
+        if (all_of(begin(bucket.entries), end(bucket.entries), [](Entry &entry) { return entry.data.load(memory_order_relaxed) != 0; }))
+            telemetry.ttCollisions++;
+#endif
+        return false;
+    }
+
+    // Stores a result. An entry for the same position is overwritten unless it
+    // comes from a much deeper search of the current generation and the new
+    // bound is not exact; otherwise the victim is the entry with the lowest
+    // depth, counting each generation of age as eight plies of depth.
+    void store(uint64_t key, Move move, int score, int eval, int depth, Bound bound)
+    {
+        Bucket &bucket = bucketFor(key);
+        Entry *victim = &bucket.entries[0];
+        int victimWorth = INT_MAX;
+        for (Entry &entry : bucket.entries)
+        {
+            uint64_t data = entry.data.load(memory_order_relaxed);
+            if ((entry.keyXorData.load(memory_order_relaxed) ^ data) == key && data)
+            {
+                if (bound != BOUND_EXACT && depth + 4 < entryDepth(data) && entryGeneration(data) == generation)
+                    return;
+                // Keep the old best move rather than forgetting it.
+                if (move == Move::none())
+                    move = Move(uint16_t(data));
+                victim = &entry;
+                break;
+            }
+            int age = (generation - entryGeneration(data)) & 63;
+            int worth = entryDepth(data) - 8 * age;
+            if (worth < victimWorth)
+            {
+                victimWorth = worth;
+                victim = &entry;
+            }
+        }
+        uint64_t data = pack(move, score, eval, depth, bound, generation);
+        victim->data.store(data, memory_order_relaxed);
+        victim->keyXorData.store(key ^ data, memory_order_relaxed);
+    }
+
+    // Permille of sampled entries written during the current search, as reported
+    // by UCI "hashfull".
+    int hashfull() const
+    {
+        int used = 0, sampled = 0;
+        for (size_t i = 0; i < min<size_t>(bucketCount, 250); i++)
+            for (Entry &entry : buckets[i].entries)
+            {
+                uint64_t data = entry.data.load(memory_order_relaxed);
+                used += data && entryGeneration(data) == generation;
+                sampled++;
+            }
+        return sampled ? used * 1000 / sampled : 0;
+    }
+};
+
+TranspositionTable TT;
+
+// --- Perft ---
+// Counts the leaves of the legal move tree. Comparing against published counts
+// checks the move generator; timing it measures generator throughput.
+
+const string startFen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+string squareName(int row, int col)
+{
+    return string(1, char('a' + col)) + char('8' - row);
+}
+
+string moveToString(Move move)
+{
+    string s = squareName(move.from() / 8, move.from() % 8) + squareName(move.to() / 8, move.to() % 8);
+    if (move.type() == PROMOTION)
+        s += "pnbrqk"[move.promotedPiece() - 1];
+    return s;
+}
+
+// Finds the legal move written in coordinate notation (e2e4, e7e8q), or
+// Move::none() if there is none.
+Move parseMove(const ChessBoard &board, const string &text)
+{
+    for (Move move : board.getLegalMoves(board.getSideToMove()))
+        if (moveToString(move) == text)
+            return move;
+    return Move::none();
+}
+
+// Finds the legal move written in standard algebraic notation (Nf3, exd5,
+// O-O, e8=Q+), or Move::none() if there is none or it is ambiguous.
+Move parseSan(const ChessBoard &board, const string &text)
+{
+    const string pieceChars = "PNBRQK";
+    string san = text;
+    while (!san.empty() && string("+#!?").find(san.back()) != string::npos)
+        san.pop_back();
+    MoveList moves = board.getLegalMoves(board.getSideToMove());
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0")
+    {
+        for (Move move : moves)
+            if (move.type() == CASTLING && (move.to() % 8 == 6) == (san.size() == 3))
+                return move;
+        return Move::none();
+    }
+
+    Piece piece = PAWN, promo = EMPTY;
+    size_t begin = 0;
+    if (!san.empty() && isupper(san[0]) && pieceChars.find(san[0]) != string::npos)
+    {
+        piece = Piece(pieceChars.find(san[0]) + 1);
+        begin = 1;
+    }
+    size_t promoAt = san.find('=');
+    if (promoAt == string::npos && piece == PAWN && san.size() >= 3 && isupper(san.back()))
+        promoAt = san.size() - 1; // "e8Q" without the '='.
+    if (promoAt != string::npos)
+    {
+        size_t idx = promoAt + 1 < san.size() ? pieceChars.find(san[promoAt + 1]) : string::npos;
+        if (piece != PAWN || idx == string::npos || idx == 0 || idx == 5)
+            return Move::none();
+        promo = Piece(idx + 1);
+        san.resize(promoAt);
+    }
+    if (san.size() < begin + 2)
+        return Move::none();
+    int toCol = san[san.size() - 2] - 'a', toRow = '8' - san[san.size() - 1];
+    if (toCol < 0 || toCol > 7 || toRow < 0 || toRow > 7)
+        return Move::none();
+    int fromCol = -1, fromRow = -1;
+    for (size_t i = begin; i + 2 < san.size(); i++)
+    {
+        if (san[i] >= 'a' && san[i] <= 'h')
+            fromCol = san[i] - 'a';
+        else if (san[i] >= '1' && san[i] <= '8')
+            fromRow = '8' - san[i];
+        else if (san[i] != 'x' && san[i] != '-')
+            return Move::none();
+    }
+
+    Move found = Move::none();
+    int matches = 0;
+    for (Move move : moves)
+    {
+        if (move.type() == CASTLING || move.to() != squareIndex(toRow, toCol) || board.pieceAt(move.from()).piece != piece ||
+            move.promotedPiece() != promo || (fromCol >= 0 && move.from() % 8 != fromCol) ||
+            (fromRow >= 0 && move.from() / 8 != fromRow))
+            continue;
+        found = move;
+        matches++;
+    }
+    return matches == 1 ? found : Move::none();
+}
+
+uint64_t perft(ChessBoard &board, int depth)
+{
+    if (depth == 0)
+        return 1;
+    MoveList moves = board.getLegalMoves(board.getSideToMove());
+    if (depth == 1)
+        return moves.size();
+    uint64_t nodes = 0;
+    for (Move move : moves)
+    {
+        board.applyMove(move);
+        nodes += perft(board, depth - 1);
+        board.undoMove(move);
+    }
+    return nodes;
+}
+
+struct PerftCase
+{
+    const char *name;
+    const char *fen;
+    vector<uint64_t> nodes; // Known node counts for depth 1, 2, ...
+};
+
+// Standard positions from the chess programming community, chosen to cover
+// castling rights, en passant (including discovered checks) and promotions.
+const vector<PerftCase> perftSuite = {
+    { "Initial position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      { 20, 400, 8902, 197281, 4865609, 119060324 } },
+    { "Kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      { 48, 2039, 97862, 4085603, 193690690, 8031647685 } },
+    { "Rank pins and en passant", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+      { 14, 191, 2812, 43238, 674624, 11030083 } },
+    { "Promotions and castling", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      { 6, 264, 9467, 422333, 15833292, 706045033 } },
+    { "Promotions and castling (mirrored)", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+      { 6, 264, 9467, 422333, 15833292, 706045033 } },
+    { "Promotion with discovered check", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      { 44, 1486, 62379, 2103487, 89941194, 3048196529 } },
+    { "Middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+      { 46, 2079, 89890, 3894594, 164075551, 6923051137 } },
+    { "Illegal en passant (rank pin)", "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1",
+      { 18, 92, 1670, 10138, 185429, 1134888 } },
+    { "Illegal en passant (diagonal pin)", "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1",
+      { 13, 102, 1266, 10276, 135655, 1015133 } },
+    { "En passant gives check", "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1",
+      { 15, 126, 1928, 13931, 206379, 1440467 } },
+    { "Short castling gives check", "5k2/8/8/8/8/8/8/4K2R w K - 0 1",
+      { 15, 66, 1198, 6399, 120330, 661072 } },
+    { "Long castling gives check", "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1",
+      { 16, 71, 1286, 7418, 141077, 803711 } },
+    { "Castling rights", "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1",
+      { 26, 1141, 27826, 1274206 } },
+    { "Castling prevented", "r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1",
+      { 44, 1494, 50509, 1720476 } },
+    { "Promote out of check", "2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1",
+      { 11, 133, 1442, 19174, 266199, 3821001 } },
+    { "Discovered check", "8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1",
+      { 29, 165, 5160, 31961, 1004658 } },
+    { "Promote to give check", "4k3/1P6/8/8/8/8/K7/8 w - - 0 1",
+      { 9, 40, 472, 2661, 38983, 217342 } },
+    { "Underpromote to give check", "8/P1k5/K7/8/8/8/8/8 w - - 0 1",
+      { 6, 27, 273, 1329, 18135, 92683 } },
+    { "Self stalemate", "K1k5/8/P7/8/8/8/8/8 w - - 0 1",
+      { 2, 6, 13, 63, 382, 2217 } },
+    { "Stalemate and checkmate", "8/k1P5/8/1K6/8/8/8/8 w - - 0 1",
+      { 10, 25, 268, 926, 10857, 43261, 567584 } },
+    { "Checkmate and stalemate", "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1",
+      { 37, 183, 6559, 23527 } },
+};
+
+// Positions loadFen must refuse, since move generation cannot handle them.
+const vector<const char *> rejectedFens = {
+    "4k3/8/8/8/8/8/4R3/4K3 w - - 0 1", // Side not to move in check.
+};
+
+// Positions whose en passant field names no double push; it must be ignored.
+const vector<const char *> phantomEnPassantFens = {
+    "4k3/8/8/3P4/8/8/8/4K3 w - e6 0 1",       // No pawn beyond the target.
+    "4k3/4p3/8/3Pp3/8/8/8/4K3 w - e6 0 1",    // The pawn's start square is occupied.
+    "4k3/8/8/8/4P3/4P3/8/4K3 b - e3 0 1",     // The target square is occupied.
+};
+
+int runPerftSuite(int depth)
+{
+    uint64_t totalNodes = 0;
+    double totalSeconds = 0;
+    int failures = 0;
+    for (size_t i = 0; i < perftSuite.size(); i++)
+    {
+        const PerftCase &test = perftSuite[i];
+        ChessBoard board;
+        board.loadFen(test.fen);
+        auto start = chrono::steady_clock::now();
+        uint64_t nodes = perft(board, depth);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        totalNodes += nodes;
+        totalSeconds += seconds;
+
+        string result = "unchecked";
+        if ((size_t)depth <= test.nodes.size())
+        {
+            uint64_t expected = test.nodes[depth - 1];
+            result = (nodes == expected) ? "OK" : "FAIL (expected " + to_string(expected) + ")";
+            if (nodes != expected)
+                failures++;
+        }
+        cout << setw(2) << i + 1 << ". " << left << setw(36) << test.name << right
+             << " depth " << depth
+             << "  nodes " << setw(11) << nodes
+             << "  time " << setw(8) << fixed << setprecision(3) << seconds << " s"
+             << "  nps " << setw(10) << (uint64_t)(nodes / max(seconds, 1e-9))
+             << "  " << result << endl;
+    }
+    cout << "\nTotal nodes " << totalNodes << "  time " << fixed << setprecision(3) << totalSeconds
+         << " s  nps " << (uint64_t)(totalNodes / max(totalSeconds, 1e-9)) << endl;
+    for (const char *fen : rejectedFens)
+    {
+        ChessBoard board;
+        if (board.loadFen(fen))
+        {
+            cout << "FAIL: accepted invalid FEN " << fen << endl;
+            failures++;
+        }
+    }
+    for (const char *fen : phantomEnPassantFens)
+    {
+        ChessBoard board;
+        if (!board.loadFen(fen) || board.getEnPassantTarget().first >= 0)
+        {
+            cout << "FAIL: kept a phantom en passant square in " << fen << endl;
+            failures++;
+        }
+    }
+    cout << (failures ? to_string(failures) + " position(s) FAILED" : "All positions passed") << endl;
+    return failures ? 1 : 0;
+}
+
+// Prints the subtree count under every root move, the usual way to narrow a
+// perft mismatch down to a single move.
+int runDivide(int depth, const string &fen)
+{
+    ChessBoard board;
+    if (!board.loadFen(fen))
+    {
+        cout << "Invalid FEN: " << fen << endl;
+        return 1;
+    }
+    auto start = chrono::steady_clock::now();
+    uint64_t total = 0;
+    for (Move move : board.getLegalMoves(board.getSideToMove()))
+    {
+        board.applyMove(move);
+        uint64_t nodes = perft(board, depth - 1);
+        board.undoMove(move);
+        total += nodes;
+        cout << moveToString(move) << ": " << nodes << endl;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "\nNodes " << total << "  time " << fixed << setprecision(3) << seconds
+         << " s  nps " << (uint64_t)(total / max(seconds, 1e-9)) << endl;
+    return 0;
+}
+
+// --- Parallel Perft ---
+// The tree is split into subtrees a few plies below the root; each thread
+// owns a deque of them and steals from the front of the others' deques when
+// its own runs dry. Transpositions are counted once through a shared cache.
+
+// Lock-free cache of subtree counts keyed by (position, depth). Each entry is
+// stored as key ^ data beside data, so a torn write from a racing thread just
+// fails the check and reads as a miss. Every bucket has a depth-preferred
+// slot and an always-replace slot.
+class PerftCache
+{
+private:
+    struct Entry
+    {
+        atomic<uint64_t> keyXorData{ 0 };
+        atomic<uint64_t> data{ 0 }; // count << 8 | depth
+    };
+    unique_ptr<Entry[]> entries;
+    size_t bucketCount = 0;
+
+    static uint64_t mix(uint64_t key, int depth)
+    {
+        return key ^ (uint64_t(depth) * 0x9E3779B97F4A7C15ULL);
+    }
+
+public:
+    explicit PerftCache(size_t megabytes)
+    {
+        bucketCount = max<size_t>(megabytes * 1024 * 1024 / (2 * sizeof(Entry)), 1);
+        entries.reset(new Entry[bucketCount * 2]);
+    }
+
+    bool probe(uint64_t key, int depth, uint64_t &count) const
+    {
+        uint64_t k = mix(key, depth);
+        Entry *bucket = &entries[(k % bucketCount) * 2];
+        for (int i = 0; i < 2; i++)
+        {
+            uint64_t data = bucket[i].data.load(memory_order_relaxed);
+            if ((bucket[i].keyXorData.load(memory_order_relaxed) ^ data) == k && int(data & 0xFF) == depth)
+            {
+                count = data >> 8;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(uint64_t key, int depth, uint64_t count)
+    {
+        uint64_t k = mix(key, depth);
+        Entry *bucket = &entries[(k % bucketCount) * 2];
+        uint64_t data = count << 8 | uint64_t(depth);
+        Entry &slot = depth >= int(bucket[0].data.load(memory_order_relaxed) & 0xFF) ? bucket[0] : bucket[1];
+        slot.keyXorData.store(k ^ data, memory_order_relaxed);
+        slot.data.store(data, memory_order_relaxed);
+    }
+};
+
+// perft with bulk counting at depth 1 and cached subtrees from depth 2 up.
+uint64_t perftCached(ChessBoard &board, int depth, PerftCache &cache)
+{
+    if (depth <= 1)
+        return depth == 0 ? 1 : board.getLegalMoves(board.getSideToMove()).size();
+    uint64_t nodes;
+    if (cache.probe(board.getKey(), depth, nodes))
+        return nodes;
+    nodes = 0;
+    for (Move move : board.getLegalMoves(board.getSideToMove()))
+    {
+        board.applyMove(move);
+        nodes += perftCached(board, depth - 1, cache);
+        board.undoMove(move);
+    }
+    cache.store(board.getKey(), depth, nodes);
+    return nodes;
+}
+
+// A subtree task: the moves from the root down to it.
+struct PerftTask
+{
+    Move path[4];
+    int length = 0;
+};
+
+void collectPerftTasks(ChessBoard &board, int splitDepth, PerftTask &prefix, vector<PerftTask> &tasks)
+{
+    if (prefix.length == splitDepth)
+    {
+        tasks.push_back(prefix);
+        return;
+    }
+    for (Move move : board.getLegalMoves(board.getSideToMove()))
+    {
+        prefix.path[prefix.length++] = move;
+        board.applyMove(move);
+        collectPerftTasks(board, splitDepth, prefix, tasks);
+        board.undoMove(move);
+        prefix.length--;
+    }
+}
+
+class WorkStealingQueue
+{
+private:
+    deque<PerftTask> tasks;
+    mutex lock;
+
+public:
+    void push(const PerftTask &task)
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(task);
+    }
+
+    // The owner works from the back, thieves take from the front.
+    bool pop(PerftTask &task, bool steal)
+    {
+        lock_guard<mutex> guard(lock);
+        if (tasks.empty())
+            return false;
+        task = steal ? tasks.front() : tasks.back();
+        if (steal)
+            tasks.pop_front();
+        else
+            tasks.pop_back();
+        return true;
+    }
+};
+
+uint64_t parallelPerft(const ChessBoard &root, int depth, int threadCount, size_t cacheMB = 64)
+{
+    threadCount = max(threadCount, 1);
+    PerftCache cache(cacheMB);
+    ChessBoard board = root;
+    if (depth <= 2)
+        return perftCached(board, depth, cache);
+
+    // Split deep enough to give every thread plenty of subtrees to balance with.
+    int splitDepth = 1;
+    vector<PerftTask> tasks;
+    PerftTask prefix;
+    while (true)
+    {
+        tasks.clear();
+        collectPerftTasks(board, splitDepth, prefix, tasks);
+        if (tasks.size() >= size_t(threadCount) * 16 || splitDepth >= min(depth - 2, 4))
+            break;
+        splitDepth++;
+    }
+
+    vector<WorkStealingQueue> queues(threadCount);
+    for (size_t i = 0; i < tasks.size(); i++)
+        queues[i % threadCount].push(tasks[i]);
+
+    atomic<uint64_t> total{ 0 };
+    vector<thread> workers;
+    for (int id = 0; id < threadCount; id++)
+        workers.emplace_back([&, id] {
+            ChessBoard local = root;
+            uint64_t nodes = 0;
+            PerftTask task;
+            while (true)
+            {
+                bool found = queues[id].pop(task, false);
+                for (int i = 1; !found && i < threadCount; i++)
+                    found = queues[(id + i) % threadCount].pop(task, true);
+                if (!found)
+                    break;
+                for (int i = 0; i < task.length; i++)
+                    local.applyMove(task.path[i]);
+                nodes += perftCached(local, depth - task.length, cache);
+                for (int i = task.length - 1; i >= 0; i--)
+                    local.undoMove(task.path[i]);
+            }
+            total += nodes;
+            telemetryFlush();
+        });
+    for (thread &worker : workers)
+        worker.join();
+    return total;
+}
+
+// Runs the parallel perft at 1, 2, 4, ... threads with a fresh cache each time.
+int runPerftScaling(int depth, int maxThreads, const string &fen)
+{
+    ChessBoard board;
+    if (!board.loadFen(fen))
+    {
+        cout << "Invalid FEN: " << fen << endl;
+        return 1;
+    }
+    cout << "Parallel perft, depth " << depth << ", " << thread::hardware_concurrency() << " hardware threads\n"
+         << setw(8) << "threads" << setw(16) << "nodes" << setw(10) << "ms" << setw(14) << "nps" << setw(10)
+         << "speedup" << endl;
+    double baseSeconds = 0;
+    uint64_t firstCount = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        auto start = chrono::steady_clock::now();
+        uint64_t nodes = parallelPerft(board, depth, threads);
+        double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+        if (threads == 1)
+        {
+            baseSeconds = seconds;
+            firstCount = nodes;
+        }
+        cout << setw(8) << threads << setw(16) << nodes << setw(10) << (int64_t)(seconds * 1000) << setw(14)
+             << (uint64_t)(nodes / seconds) << setw(10) << fixed << setprecision(2) << baseSeconds / seconds
+             << (nodes != firstCount ? "  MISMATCH" : "") << endl;
+        if (nodes != firstCount)
+            return 1;
+    }
+    return 0;
+}
+
+// --- Pawn Structure ---
+// Doubled, isolated, backward and passed pawns depend on the pawns alone, so
+// they are cached per thread in a PawnTable keyed by the board's pawnKey,
+// together with the passed-pawn bitboards. King shelter also depends on the
+// king square and is cached in the same entry for the last square seen.
+
+uint64_t fileMask[8];
+uint64_t adjacentFilesMask[8];
+uint64_t passedPawnMask[3][64]; // Squares ahead on the same and adjacent files, by Color.
+uint64_t supportMask[3][64];    // Adjacent-file squares level with or behind, by Color.
+
+void initPawnMasks()
+{
+    for (int col = 0; col < 8; col++)
+    {
+        fileMask[col] = 0;
+        for (int row = 0; row < 8; row++)
+            fileMask[col] |= squareBit(squareIndex(row, col));
+    }
+    for (int col = 0; col < 8; col++)
+        adjacentFilesMask[col] = (col > 0 ? fileMask[col - 1] : 0) | (col < 7 ? fileMask[col + 1] : 0);
+    for (int sq = 0; sq < 64; sq++)
+    {
+        int row = sq / 8, col = sq % 8;
+        uint64_t files = fileMask[col] | adjacentFilesMask[col];
+        passedPawnMask[WHITE][sq] = passedPawnMask[BLACK][sq] = 0;
+        supportMask[WHITE][sq] = supportMask[BLACK][sq] = 0;
+        for (int r = 0; r < 8; r++)
+        {
+            uint64_t rank = 0xFFULL << (8 * r);
+            // White pawns move towards row 0, Black pawns towards row 7.
+            if (r < row)
+                passedPawnMask[WHITE][sq] |= files & rank;
+            if (r > row)
+                passedPawnMask[BLACK][sq] |= files & rank;
+            if (r >= row)
+                supportMask[WHITE][sq] |= adjacentFilesMask[col] & rank;
+            if (r <= row)
+                supportMask[BLACK][sq] |= adjacentFilesMask[col] & rank;
+        }
+    }
+}
+
+const Score doubledPenalty(10, 20);
+const Score isolatedPenalty(8, 12);
+const Score backwardPenalty(6, 10);
+const Score passedBonus[8] = { {}, { 5, 10 }, { 10, 20 }, { 15, 35 }, { 30, 60 }, { 50, 100 }, { 80, 150 }, {} };
+
+// Ranks a pawn of this color has advanced from its own back rank (0..7).
+inline int relativeRank(Color color, int sq)
+{
+    return color == WHITE ? 7 - sq / 8 : sq / 8;
+}
+
+struct PawnEntry
+{
+    uint64_t key = ~0ULL; // Matches no pawn structure until filled in.
+    Score score;          // White minus Black.
+    uint64_t passed[3];   // Passed pawns by Color.
+    int8_t kingSq[3];     // King square the shelter below was computed for.
+    int16_t shelter[3];
+};
+
+// Structure terms of one side's pawns; fills in its passed pawns.
+Score evaluatePawns(const Bitboards &bb, Color us, uint64_t &passed)
+{
+    Color them = us == WHITE ? BLACK : WHITE;
+    uint64_t ours = us == WHITE ? bb.whitePawns : bb.blackPawns;
+    uint64_t theirs = them == WHITE ? bb.whitePawns : bb.blackPawns;
+    Score score;
+    passed = 0;
+    for (uint64_t pawns = ours; pawns;)
+    {
+        int sq = popLsb(pawns);
+        int col = sq % 8;
+        int stop = us == WHITE ? sq - 8 : sq + 8;
+        if (passedPawnMask[us][sq] & fileMask[col] & ours)
+            score -= doubledPenalty;
+        if (!(ours & adjacentFilesMask[col]))
+            score -= isolatedPenalty;
+        else if (!(ours & supportMask[us][sq]) && (pawnAttacks[us][stop] & theirs))
+            score -= backwardPenalty;
+        if (!(passedPawnMask[us][sq] & theirs) && !(passedPawnMask[us][sq] & fileMask[col] & ours))
+        {
+            passed |= squareBit(sq);
+            score += passedBonus[relativeRank(us, sq)];
+        }
+    }
+    return score;
+}
+
+// Midgame bonus for own pawns on the king's file and the files beside it,
+// more for those right in front; an open file next to the king costs extra.
+int kingShelter(const Bitboards &bb, Color us, int kingSq)
+{
+    uint64_t ours = us == WHITE ? bb.whitePawns : bb.blackPawns;
+    int col = min(max(kingSq % 8, 1), 6);
+    int shelter = 0;
+    for (int file = col - 1; file <= col + 1; file++)
+    {
+        uint64_t front = ours & fileMask[file] & passedPawnMask[us][squareIndex(kingSq / 8, file)];
+        if (!front)
+        {
+            shelter -= 15;
+            continue;
+        }
+        int nearest = us == WHITE ? msb(front) : lsb(front);
+        int distance = abs(nearest / 8 - kingSq / 8);
+        shelter += distance == 1 ? 12 : distance == 2 ? 6 : 0;
+    }
+    return shelter;
+}
+
+void computePawnEntry(const ChessBoard &board, PawnEntry &entry)
+{
+    const Bitboards &bb = board.getBitboards();
+    entry.key = board.getPawnKey();
+    entry.score = evaluatePawns(bb, WHITE, entry.passed[WHITE]);
+    entry.score -= evaluatePawns(bb, BLACK, entry.passed[BLACK]);
+    entry.kingSq[WHITE] = entry.kingSq[BLACK] = -1;
+}
+
+int cachedShelter(const Bitboards &bb, PawnEntry &entry, Color color)
+{
+    int kingSq = lsb(bb.pieces(KING, color));
+    if (entry.kingSq[color] != kingSq)
+    {
+        entry.kingSq[color] = int8_t(kingSq);
+        entry.shelter[color] = int16_t(kingShelter(bb, color, kingSq));
+    }
+    return entry.shelter[color];
+}
+
+class PawnTable
+{
+private:
+    static const int SIZE = 8192; // Entries; a power of two.
+    vector<PawnEntry> entries;
+
+public:
+    uint64_t probes = 0, hits = 0;
+
+    PawnTable() : entries(SIZE) {}
+
+    PawnEntry &probe(const ChessBoard &board)
+    {
+        PawnEntry &entry = entries[board.getPawnKey() & (SIZE - 1)];
+        probes++;
+        if (entry.key == board.getPawnKey())
+            hits++;
+        else
+            computePawnEntry(board, entry);
+        return entry;
+    }
+};
+
+// --- Evaluation ---
+// The material and piece-square sum comes incrementally from the board; the
+// mobility and king-safety terms are bitboard popcounts over the pieces. The
+// midgame and endgame totals are blended by game phase. pieceValues are the
+// plain exchange values used by SEE and move ordering.
+
+const int pieceValues[7] = { 0, 100, 320, 330, 500, 900, 0 };
+
+// Per safe square attacked, and the count a piece is expected to have.
+const Score mobilityWeight[7] = { {}, {}, { 4, 4 }, { 5, 5 }, { 2, 4 }, { 1, 2 }, {} };
+const int mobilityBase[7] = { 0, 0, 4, 6, 7, 13, 0 };
+// King-danger units per attacker of a square next to the enemy king.
+const int kingAttackWeight[7] = { 0, 0, 2, 2, 3, 5, 0 };
+const int TEMPO = 10;
+
+// Mobility of one side, and its attack units on the squares around the enemy king.
+Score evaluatePieces(const ChessBoard &board, Color us, int &kingAttackUnits)
+{
+    const Bitboards &bb = board.getBitboards();
+    Color them = us == WHITE ? BLACK : WHITE;
+    uint64_t theirPawns = bb.pieces(PAWN, them);
+    uint64_t pawnCovered = 0;
+    while (theirPawns)
+        pawnCovered |= pawnAttacks[them][popLsb(theirPawns)];
+    uint64_t safe = ~bb.occupancy(us) & ~pawnCovered;
+    uint64_t kingZone = kingAttacks[lsb(bb.pieces(KING, them))];
+
+    Score score;
+    kingAttackUnits = 0;
+    for (int piece = KNIGHT; piece <= QUEEN; piece++)
+    {
+        uint64_t pieces = bb.pieces(Piece(piece), us);
+        while (pieces)
+        {
+            int sq = popLsb(pieces);
+            uint64_t attacks = piece == KNIGHT ? knightAttacks[sq]
+                               : piece == BISHOP ? bishopAttacks(sq, bb.allPieces)
+                               : piece == ROOK   ? rookAttacks(sq, bb.allPieces)
+                                                 : queenAttacks(sq, bb.allPieces);
+            int count = popCount(attacks & safe) - mobilityBase[piece];
+            score.mg += mobilityWeight[piece].mg * count;
+            score.eg += mobilityWeight[piece].eg * count;
+            kingAttackUnits += kingAttackWeight[piece] * popCount(attacks & kingZone);
+        }
+    }
+    return score;
+}
+
+// King danger grows quadratically with the attack units and only matters
+// while the attacker still has its queen.
+int kingDanger(const ChessBoard &board, Color attacker, int units)
+{
+    if (!board.getBitboards().pieces(QUEEN, attacker))
+        return 0;
+    return min(units * units, 400);
+}
+
+// Pawn terms come from the thread's pawn table when one is given, otherwise
+// they are computed on the spot.
+int evaluate(const ChessBoard &board, PawnTable *pawnTable = nullptr)
+{
+    const Bitboards &bb = board.getBitboards();
+    PawnEntry local;
+    PawnEntry &pawns = pawnTable ? pawnTable->probe(board) : local;
+    if (!pawnTable)
+        computePawnEntry(board, local);
+
+    int whiteUnits, blackUnits;
+    Score score = board.getPsq();
+    score += pawns.score;
+    score.mg += cachedShelter(bb, pawns, WHITE) - cachedShelter(bb, pawns, BLACK);
+    // A passed pawn whose next square is free is worth more in the endgame.
+    for (Color color : { WHITE, BLACK })
+    {
+        uint64_t stops = color == WHITE ? pawns.passed[WHITE] >> 8 : pawns.passed[BLACK] << 8;
+        int free = popCount(stops & ~bb.allPieces) * 10;
+        score.eg += color == WHITE ? free : -free;
+    }
+    score += evaluatePieces(board, WHITE, whiteUnits);
+    score -= evaluatePieces(board, BLACK, blackUnits);
+    score.mg += kingDanger(board, WHITE, whiteUnits) - kingDanger(board, BLACK, blackUnits);
+
+    int phase = board.getPhase();
+    int blended = (score.mg * phase + score.eg * (MAX_PHASE - phase)) / MAX_PHASE;
+    return (board.getSideToMove() == WHITE ? blended : -blended) + TEMPO;
+}
+
+// --- NNUE ---
+// A HalfKP network: each side sees every non-king piece relative to its own
+// king (64 king squares x 10 piece kinds x 64 squares). The first layer is a
+// sum of int16 weight rows over the active features, kept per side in an
+// accumulator that follows the moves: applyMove records the changed pieces
+// and the accumulator applies them as adds and subtracts, recomputing from
+// scratch only when that side's king moved. The int8 hidden layers then run
+// on the clipped accumulators of the side to move and the other side.
+//
+// File layout (little endian, each section 64-byte aligned so the weights
+// can be used straight from the mapping):
+//   header: "HKP1", then uint32 inputs, L1, L2, L3, padded to 64 bytes
+//   int16 ftBias[L1], int16 ftWeights[inputs][L1]
+//   int32 l1Bias[L2], int8 l1Weights[L2][2 * L1]
+//   int32 l2Bias[L3], int8 l2Weights[L3][L2]
+//   int32 outBias, int8 outWeights[L3]
+
+const int NNUE_INPUTS = 64 * 10 * 64;
+const int NNUE_L1 = 256;
+const int NNUE_L2 = 32;
+const int NNUE_L3 = 32;
+const int NNUE_WEIGHT_SHIFT = 6; // Hidden layer outputs are scaled by 2^6.
+const int NNUE_OUTPUT_SCALE = 16; // Network output units per centipawn.
+
+size_t alignSection(size_t offset)
+{
+    return (offset + 63) & ~size_t(63);
+}
+
+// Weights of a loaded network. The pointers point into a read-only mapping
+// of the file (or of the built-in test net), shared by all search threads.
+class Network
+{
+private:
+    void *mapping = nullptr;
+    size_t mappedBytes = 0;
+
+    static size_t expectedBytes()
+    {
+        size_t offset = 64;
+        offset = alignSection(offset + NNUE_L1 * 2);
+        offset = alignSection(offset + size_t(NNUE_INPUTS) * NNUE_L1 * 2);
+        offset = alignSection(offset + NNUE_L2 * 4);
+        offset = alignSection(offset + NNUE_L2 * 2 * NNUE_L1);
+        offset = alignSection(offset + NNUE_L3 * 4);
+        offset = alignSection(offset + NNUE_L3 * NNUE_L2);
+        offset = alignSection(offset + 4);
+        return alignSection(offset + NNUE_L3);
+    }
+
+    // Points the weight pointers into the mapping after checking the header.
+    bool bind(const uint8_t *data, size_t bytes)
+    {
+        uint32_t dims[4];
+        memcpy(dims, data + 4, sizeof(dims));
+        if (bytes < expectedBytes() || memcmp(data, "HKP1", 4) != 0 || dims[0] != NNUE_INPUTS ||
+            dims[1] != NNUE_L1 || dims[2] != NNUE_L2 || dims[3] != NNUE_L3)
+            return false;
+        size_t offset = 64;
+        ftBias = reinterpret_cast<const int16_t *>(data + offset);
+        offset = alignSection(offset + NNUE_L1 * 2);
+        ftWeights = reinterpret_cast<const int16_t *>(data + offset);
+        offset = alignSection(offset + size_t(NNUE_INPUTS) * NNUE_L1 * 2);
+        l1Bias = reinterpret_cast<const int32_t *>(data + offset);
+        offset = alignSection(offset + NNUE_L2 * 4);
+        l1Weights = reinterpret_cast<const int8_t *>(data + offset);
+        offset = alignSection(offset + NNUE_L2 * 2 * NNUE_L1);
+        l2Bias = reinterpret_cast<const int32_t *>(data + offset);
+        offset = alignSection(offset + NNUE_L3 * 4);
+        l2Weights = reinterpret_cast<const int8_t *>(data + offset);
+        offset = alignSection(offset + NNUE_L3 * NNUE_L2);
+        outBias = reinterpret_cast<const int32_t *>(data + offset);
+        offset = alignSection(offset + 4);
+        outWeights = reinterpret_cast<const int8_t *>(data + offset);
+        loaded = true;
+        return true;
+    }
+
+public:
+    bool loaded = false;
+    const int16_t *ftBias = nullptr, *ftWeights = nullptr;
+    const int32_t *l1Bias = nullptr, *l2Bias = nullptr, *outBias = nullptr;
+    const int8_t *l1Weights = nullptr, *l2Weights = nullptr, *outWeights = nullptr;
+
+    Network() = default;
+    Network(const Network &) = delete;
+    Network &operator=(const Network &) = delete;
+
+    ~Network()
+    {
+        release();
+    }
+
+    // Drops the network; evaluation falls back to the hand-written terms.
+    void release()
+    {
+        if (mapping)
+            munmap(mapping, mappedBytes);
+        mapping = nullptr;
+        mappedBytes = 0;
+        loaded = false;
+    }
+
+    // Maps the file read-only; nothing is copied. Returns false (and keeps no
+    // network) if the file cannot be mapped or does not match this layout.
+    bool load(const string &path)
+    {
+        release();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        void *memory = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            return false;
+        mapping = memory;
+        mappedBytes = info.st_size;
+        if (!bind(static_cast<const uint8_t *>(mapping), mappedBytes))
+        {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    // Builds a deterministic pseudo-random network in memory, in the file
+    // layout, so the loader, the kernels and the incremental updates can be
+    // checked without a trained net. Its evaluations are meaningless.
+    void loadTestNetwork()
+    {
+        release();
+        size_t bytes = expectedBytes();
+        void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return;
+        uint8_t *data = static_cast<uint8_t *>(memory);
+        memcpy(data, "HKP1", 4);
+        uint32_t dims[4] = { NNUE_INPUTS, NNUE_L1, NNUE_L2, NNUE_L3 };
+        memcpy(data + 4, dims, sizeof(dims));
+        mapping = memory;
+        mappedBytes = bytes;
+        bind(data, bytes);
+
+        PRNG rng(20240611);
+        auto fill16 = [&](const int16_t *p, size_t n, int lo, int hi) {
+            for (size_t i = 0; i < n; i++)
+                const_cast<int16_t *>(p)[i] = int16_t(lo + int(rng.rand64() % uint64_t(hi - lo + 1)));
+        };
+        auto fill8 = [&](const int8_t *p, size_t n, int lo, int hi) {
+            for (size_t i = 0; i < n; i++)
+                const_cast<int8_t *>(p)[i] = int8_t(lo + int(rng.rand64() % uint64_t(hi - lo + 1)));
+        };
+        auto fill32 = [&](const int32_t *p, size_t n, int lo, int hi) {
+            for (size_t i = 0; i < n; i++)
+                const_cast<int32_t *>(p)[i] = lo + int(rng.rand64() % uint64_t(hi - lo + 1));
+        };
+        fill16(ftBias, NNUE_L1, 0, 64);
+        fill16(ftWeights, size_t(NNUE_INPUTS) * NNUE_L1, -12, 12);
+        fill32(l1Bias, NNUE_L2, -2000, 2000);
+        fill8(l1Weights, NNUE_L2 * 2 * NNUE_L1, -20, 20);
+        fill32(l2Bias, NNUE_L3, -2000, 2000);
+        fill8(l2Weights, NNUE_L3 * NNUE_L2, -60, 60);
+        fill32(outBias, 1, -500, 500);
+        fill8(outWeights, NNUE_L3, -100, 100);
+        mprotect(memory, bytes, PROT_READ);
+    }
+
+    // Writes the current network in the file layout (used to produce a test file).
+    bool save(const string &path) const
+    {
+        if (!loaded)
+            return false;
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(mapping, 1, expectedBytes(), file) == expectedBytes();
+        return fclose(file) == 0 && ok;
+    }
+};
+
+Network network;
+
+// Feature index of a non-king piece as seen by the side `perspective` whose
+// king is on kingSq. Black's view is flipped vertically so both sides see
+// their own pieces moving up the board.
+inline int featureIndex(Color perspective, int kingSq, Piece piece, Color color, int sq)
+{
+    int flip = perspective == WHITE ? 0 : 56;
+    int kind = (piece - PAWN) * 2 + (color == perspective ? 0 : 1);
+    return ((kingSq ^ flip) * 10 + kind) * 64 + (sq ^ flip);
+}
+
+// --- NNUE Kernels ---
+// Each kernel has a scalar version, always compiled (the reference that the
+// "nnue verify" command compares against), and a SIMD version picked at
+// build time.
+
+void addRowScalar(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i++)
+        acc[i] += row[i];
+}
+
+void subRowScalar(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i++)
+        acc[i] -= row[i];
+}
+
+// Clamps accumulator values to [0, 127] as the uint8 input of the hidden layers.
+void clipAccumulatorScalar(uint8_t *out, const int16_t *acc)
+{
+    for (int i = 0; i < NNUE_L1; i++)
+        out[i] = uint8_t(min(max<int>(acc[i], 0), 127));
+}
+
+int32_t dotScalar(const uint8_t *input, const int8_t *weights, int size)
+{
+    int32_t sum = 0;
+    for (int i = 0; i < size; i++)
+        sum += int32_t(input[i]) * weights[i];
+    return sum;
+}
+
+#if defined(USE_AVX2)
+void addRow(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i *>(acc + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), _mm256_add_epi16(a, r));
+    }
+}
+
+void subRow(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i *>(acc + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), _mm256_sub_epi16(a, r));
+    }
+}
+
+void clipAccumulator(uint8_t *out, const int16_t *acc)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_L1; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i + 16));
+        // packs saturates to [-128, 127] but interleaves the 128-bit lanes.
+        __m256i packed = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+}
+
+int32_t dot(const uint8_t *input, const int8_t *weights, int size)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < size; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + i));
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+#elif defined(USE_SSE41)
+void addRow(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i *>(acc + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), _mm_add_epi16(a, r));
+    }
+}
+
+void subRow(int16_t *acc, const int16_t *row)
+{
+    for (int i = 0; i < NNUE_L1; i += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i *>(acc + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), _mm_sub_epi16(a, r));
+    }
+}
+
+void clipAccumulator(uint8_t *out, const int16_t *acc)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_L1; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i + 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_max_epi8(_mm_packs_epi16(a, b), zero));
+    }
+}
+
+int32_t dot(const uint8_t *input, const int8_t *weights, int size)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(x, w), ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+#else
+void addRow(int16_t *acc, const int16_t *row)
+{
+    addRowScalar(acc, row);
+}
+
+void subRow(int16_t *acc, const int16_t *row)
+{
+    subRowScalar(acc, row);
+}
+
+void clipAccumulator(uint8_t *out, const int16_t *acc)
+{
+    clipAccumulatorScalar(out, acc);
+}
+
+int32_t dot(const uint8_t *input, const int8_t *weights, int size)
+{
+    return dotScalar(input, weights, size);
+}
+#endif
+
+const char *simdName()
+{
+#if defined(USE_AVX2)
+    return "AVX2";
+#elif defined(USE_SSE41)
+    return "SSE4.1";
+#else
+    return "scalar";
+#endif
+}
+
+struct Accumulator
+{
+    alignas(64) int16_t values[3][NNUE_L1]; // Indexed by perspective Color.
+    uint64_t key[3];                        // Position the values belong to, per perspective.
+};
+
+// Runs the hidden layers on the two accumulators, side to move first, and
+// returns centipawns from the side to move's point of view.
+int nnueForward(const int16_t *us, const int16_t *them, bool scalar = false)
+{
+    alignas(64) uint8_t input[2 * NNUE_L1];
+    alignas(64) uint8_t hidden1[NNUE_L2];
+    alignas(64) uint8_t hidden2[NNUE_L3];
+    auto clip = scalar ? clipAccumulatorScalar : clipAccumulator;
+    auto product = scalar ? dotScalar : dot;
+    clip(input, us);
+    clip(input + NNUE_L1, them);
+    for (int i = 0; i < NNUE_L2; i++)
+    {
+        int32_t sum = network.l1Bias[i] + product(input, network.l1Weights + i * 2 * NNUE_L1, 2 * NNUE_L1);
+        hidden1[i] = uint8_t(min(max(sum >> NNUE_WEIGHT_SHIFT, 0), 127));
+    }
+    for (int i = 0; i < NNUE_L3; i++)
+    {
+        int32_t sum = network.l2Bias[i] + product(hidden1, network.l2Weights + i * NNUE_L2, NNUE_L2);
+        hidden2[i] = uint8_t(min(max(sum >> NNUE_WEIGHT_SHIFT, 0), 127));
+    }
+    int32_t output = network.outBias[0] + product(hidden2, network.outWeights, NNUE_L3);
+    return output / NNUE_OUTPUT_SCALE;
+}
+
+// Recomputes one side's accumulator from the pieces on the board.
+void refreshAccumulator(const ChessBoard &board, Color perspective, int16_t *values, bool scalar = false)
+{
+    const Bitboards &bb = board.getBitboards();
+    int kingSq = lsb(bb.pieces(KING, perspective));
+    memcpy(values, network.ftBias, NNUE_L1 * sizeof(int16_t));
+    uint64_t pieces = bb.allPieces & ~(bb.whiteKing | bb.blackKing);
+    while (pieces)
+    {
+        int sq = popLsb(pieces);
+        Square square = board.pieceAt(sq);
+        const int16_t *row = network.ftWeights + size_t(featureIndex(perspective, kingSq, square.piece, square.color, sq)) * NNUE_L1;
+        (scalar ? addRowScalar : addRow)(values, row);
+    }
+}
+
+// Per-thread accumulators, one per ply from the search root. An entry is
+// valid for a side when its key matches the position at that ply, so moves
+// that are undone never need to be cleaned up after.
+class NnueStack
+{
+private:
+    vector<Accumulator> stack;
+    int rootPly = 0;
+
+    bool kingMoved(const UndoInfo &undo, Color color) const
+    {
+        for (int i = 0; i < undo.dirtyCount; i++)
+            if (undo.dirty[i].piece == KING && undo.dirty[i].color == color)
+                return true;
+        return false;
+    }
+
+    bool valid(const ChessBoard &board, Color perspective, int index) const
+    {
+        return stack[index].key[perspective] == board.keyAt(rootPly + index);
+    }
+
+    void update(const ChessBoard &board, Color perspective, int index)
+    {
+        if (valid(board, perspective, index))
+            return;
+        // Walk back to the nearest valid entry, unless a king move on the way
+        // forces a refresh anyway.
+        int start = index;
+        do
+        {
+            if (start == 0 || kingMoved(board.undoAt(rootPly + start), perspective))
+            {
+                refreshAccumulator(board, perspective, stack[index].values[perspective]);
+                stack[index].key[perspective] = board.keyAt(rootPly + index);
+                return;
+            }
+            start--;
+        } while (!valid(board, perspective, start));
+
+        int kingSq = lsb(board.getBitboards().pieces(KING, perspective));
+        for (int i = start + 1; i <= index; i++)
+        {
+            Accumulator &next = stack[i];
+            memcpy(next.values[perspective], stack[i - 1].values[perspective], sizeof(next.values[perspective]));
+            const UndoInfo &undo = board.undoAt(rootPly + i);
+            for (int j = 0; j < undo.dirtyCount; j++)
+            {
+                const DirtyPiece &d = undo.dirty[j];
+                if (d.piece == KING)
+                    continue;
+                if (d.from >= 0)
+                    subRow(next.values[perspective], network.ftWeights + size_t(featureIndex(perspective, kingSq, d.piece, d.color, d.from)) * NNUE_L1);
+                if (d.to >= 0)
+                    addRow(next.values[perspective], network.ftWeights + size_t(featureIndex(perspective, kingSq, d.piece, d.color, d.to)) * NNUE_L1);
+            }
+            next.key[perspective] = board.keyAt(rootPly + i);
+        }
+    }
+
+public:
+    explicit NnueStack(int plies) : stack(plies) {}
+
+    // Positions are indexed relative to the board's game ply at the root.
+    void reset(const ChessBoard &root)
+    {
+        rootPly = root.gamePly();
+        for (Accumulator &acc : stack)
+            acc.key[WHITE] = acc.key[BLACK] = 0;
+    }
+
+    int evaluate(const ChessBoard &board)
+    {
+        int index = board.gamePly() - rootPly;
+        if (index < 0 || index >= (int)stack.size())
+        {
+            reset(board);
+            index = 0;
+        }
+        Color us = board.getSideToMove(), them = us == WHITE ? BLACK : WHITE;
+        update(board, WHITE, index);
+        update(board, BLACK, index);
+        return nnueForward(stack[index].values[us], stack[index].values[them]);
+    }
+};
+
+// Evaluates a single position with the network, computing the accumulators
+// from scratch; used outside the search.
+int nnueEvaluateFresh(const ChessBoard &board, bool scalar = false)
+{
+    alignas(64) int16_t white[NNUE_L1], black[NNUE_L1];
+    refreshAccumulator(board, WHITE, white, scalar);
+    refreshAccumulator(board, BLACK, black, scalar);
+    return board.getSideToMove() == WHITE ? nnueForward(white, black, scalar) : nnueForward(black, white, scalar);
+}
+
+// --- Endgame Tablebases ---
+// Retrograde-analysis tables for a lone king against a few pieces. The side
+// with the material is always stored as White, so a position where Black has
+// it is flipped vertically before the lookup. Pawnless tables use the eight
+// board symmetries to keep the strong king in the a8-d8-d5 triangle; pawn
+// tables only mirror files so the pawn stays on files a-d.
+//
+// Each table is written twice: NAME.dtm holds one byte per position (0 for a
+// draw, otherwise plies to mate plus one, odd plies being wins for the side
+// to move) and NAME.wdl packs 2 bits per position (0 draw, 1 win, 2 loss).
+// Both start with a 16-byte header and are mapped read-only for probing.
+
+struct TbMaterial
+{
+    const char *name;
+    int count;       // Non-king pieces of the strong side.
+    Piece pieces[2];
+};
+
+// Generation order matters: KPK promotes into KQK and KRK.
+const TbMaterial tbMaterials[] = {
+    { "KQK", 1, { QUEEN, EMPTY } },
+    { "KRK", 1, { ROOK, EMPTY } },
+    { "KPK", 1, { PAWN, EMPTY } },
+    { "KBNK", 2, { BISHOP, KNIGHT } },
+};
+const int TB_MATERIALS = sizeof(tbMaterials) / sizeof(tbMaterials[0]);
+
+struct TbPosition
+{
+    int wk, bk;
+    int sq[2];
+    Color stm;
+};
+
+size_t tbSize(const TbMaterial &material)
+{
+    if (material.pieces[0] == PAWN)
+        return size_t(2) * 24 * 64 * 64;
+    return (size_t(2) * 10 * 64) << (6 * material.count);
+}
+
+// Symmetry that brings the strong king into the triangle: bit 0 mirrors
+// files, bit 1 mirrors rows, bit 2 swaps rows and files, applied in that order.
+// Indices are unique per position up to symmetry; the slots of positions that
+// are not in canonical form are marked invalid.
+int tbSymmetry(int kingSq)
+{
+    int row = kingSq / 8, col = kingSq % 8, symmetry = 0;
+    if (col > 3)
+        symmetry |= 1, col = 7 - col;
+    if (row > 3)
+        symmetry |= 2, row = 7 - row;
+    if (row > col)
+        symmetry |= 4;
+    return symmetry;
+}
+
+int tbTransform(int sq, int symmetry)
+{
+    int row = sq / 8, col = sq % 8;
+    if (symmetry & 1)
+        col = 7 - col;
+    if (symmetry & 2)
+        row = 7 - row;
+    if (symmetry & 4)
+        swap(row, col);
+    return squareIndex(row, col);
+}
+
+size_t tbIndex(const TbMaterial &material, TbPosition pos)
+{
+    size_t index = pos.stm == WHITE ? 0 : 1;
+    if (material.pieces[0] == PAWN)
+    {
+        if (pos.sq[0] % 8 > 3)
+        {
+            pos.wk ^= 7;
+            pos.bk ^= 7;
+            pos.sq[0] ^= 7;
+        }
+        index = index * 24 + (pos.sq[0] / 8 - 1) * 4 + pos.sq[0] % 8;
+        return (index * 64 + pos.wk) * 64 + pos.bk;
+    }
+    int symmetry = tbSymmetry(pos.wk);
+    int king = tbTransform(pos.wk, symmetry);
+    // With the king on the diagonal the first piece off it picks the side.
+    for (int i = -1; king / 8 == king % 8 && i < material.count; i++)
+    {
+        int sq = tbTransform(i < 0 ? pos.bk : pos.sq[i], symmetry);
+        if (sq / 8 != sq % 8)
+        {
+            symmetry |= sq / 8 > sq % 8 ? 4 : 0;
+            break;
+        }
+    }
+    int col = king % 8;
+    index = index * 10 + col * (col + 1) / 2 + king / 8;
+    index = index * 64 + tbTransform(pos.bk, symmetry);
+    for (int i = 0; i < material.count; i++)
+        index = index * 64 + tbTransform(pos.sq[i], symmetry);
+    return index;
+}
+
+TbPosition tbDecode(const TbMaterial &material, size_t index)
+{
+    TbPosition pos;
+    if (material.pieces[0] == PAWN)
+    {
+        pos.bk = index % 64;
+        index /= 64;
+        pos.wk = index % 64;
+        index /= 64;
+        int pawn = index % 24;
+        index /= 24;
+        pos.sq[0] = squareIndex(pawn / 4 + 1, pawn % 4);
+    }
+    else
+    {
+        for (int i = material.count - 1; i >= 0; i--)
+        {
+            pos.sq[i] = index % 64;
+            index /= 64;
+        }
+        pos.bk = index % 64;
+        index /= 64;
+        int triangle = index % 10, col = 0;
+        index /= 10;
+        while ((col + 1) * (col + 2) / 2 <= triangle)
+            col++;
+        pos.wk = squareIndex(triangle - col * (col + 1) / 2, col);
+    }
+    pos.stm = index == 0 ? WHITE : BLACK;
+    return pos;
+}
+
+uint64_t tbOccupied(const TbMaterial &material, const TbPosition &pos)
+{
+    uint64_t occupied = squareBit(pos.wk) | squareBit(pos.bk);
+    for (int i = 0; i < material.count; i++)
+        occupied |= squareBit(pos.sq[i]);
+    return occupied;
+}
+
+uint64_t tbPieceAttacks(Piece piece, int sq, uint64_t occupied)
+{
+    switch (piece)
+    {
+    case PAWN:
+        return pawnAttacks[WHITE][sq];
+    case KNIGHT:
+        return knightAttacks[sq];
+    case BISHOP:
+        return bishopAttacks(sq, occupied);
+    case ROOK:
+        return rookAttacks(sq, occupied);
+    case QUEEN:
+        return queenAttacks(sq, occupied);
+    default:
+        return 0;
+    }
+}
+
+uint64_t tbWhiteAttacks(const TbMaterial &material, const TbPosition &pos, uint64_t occupied)
+{
+    uint64_t attacks = kingAttacks[pos.wk];
+    for (int i = 0; i < material.count; i++)
+        attacks |= tbPieceAttacks(material.pieces[i], pos.sq[i], occupied);
+    return attacks;
+}
+
+bool tbValid(const TbMaterial &material, const TbPosition &pos, uint64_t occupied)
+{
+    if (popCount(occupied) != material.count + 2 || (kingAttacks[pos.wk] & squareBit(pos.bk)))
+        return false;
+    if (material.pieces[0] == PAWN && (pos.sq[0] / 8 == 0 || pos.sq[0] / 8 == 7))
+        return false;
+    // With White to move, Black cannot be in check.
+    return pos.stm == BLACK || !(tbWhiteAttacks(material, pos, occupied) & squareBit(pos.bk));
+}
+
+// Builds one table by retrograde analysis. Iteration n finds the positions
+// mated in exactly n plies: odd passes walk White moves backwards from the
+// Black losses of the previous pass, even passes walk Black king moves
+// backwards from the new White wins and keep the positions whose every move
+// reaches a win. Each pass depends only on the previous one, so the result
+// does not depend on the number of threads.
+class TablebaseGenerator
+{
+private:
+    // Working values: dtm + 1 for decided positions, or one of these.
+    static const uint8_t UNKNOWN = 0, DRAW = 254, INVALID = 255;
+
+    const TbMaterial &material;
+    const vector<vector<uint8_t>> &finished; // DTM bytes of the tables already built.
+    int threads;
+    size_t size;
+    unique_ptr<atomic<uint8_t>[]> values;
+    vector<uint8_t> exits; // Plies to mate through a promotion, White to move; 0 = none.
+
+    // Runs body over [begin, end) split across the threads and returns the
+    // number of indices for which it reported a change.
+    template <typename Body>
+    size_t forEach(size_t begin, size_t end, Body body)
+    {
+        atomic<size_t> changed{ 0 };
+        vector<thread> workers;
+        size_t chunk = (end - begin + threads - 1) / threads;
+        for (int t = 0; t < threads; t++)
+            workers.emplace_back([&, t] {
+                size_t local = 0;
+                for (size_t i = begin + t * chunk; i < min(end, begin + (t + 1) * chunk); i++)
+                    local += body(i) ? 1 : 0;
+                changed += local;
+            });
+        for (auto &worker : workers)
+            worker.join();
+        return changed;
+    }
+
+    bool settle(size_t index, int dtm)
+    {
+        uint8_t expected = UNKNOWN;
+        return values[index].compare_exchange_strong(expected, uint8_t(dtm + 1), memory_order_relaxed);
+    }
+
+    bool isWin(uint8_t value) const
+    {
+        return value != UNKNOWN && value < DRAW && (value - 1) % 2 == 1;
+    }
+
+    // Shortest mate White reaches by promoting, looked up in KQK and KRK.
+    int promotionExit(const TbPosition &pos, uint64_t occupied) const
+    {
+        if (material.pieces[0] != PAWN || pos.sq[0] / 8 != 1 || (occupied & squareBit(pos.sq[0] - 8)))
+            return 0;
+        TbPosition next = { pos.wk, pos.bk, { pos.sq[0] - 8, 0 }, BLACK };
+        int best = 0;
+        for (int table = 0; table < 2; table++)
+        {
+            uint8_t value = finished[table][tbIndex(tbMaterials[table], next)];
+            if (value && (value - 1) % 2 == 0 && (!best || value < best))
+                best = value; // Black mated in value - 1 plies after the promotion.
+        }
+        return best;
+    }
+
+    bool whiteCanMove(const TbPosition &pos, uint64_t occupied) const
+    {
+        if (kingAttacks[pos.wk] & ~occupied & ~kingAttacks[pos.bk])
+            return true;
+        for (int i = 0; i < material.count; i++)
+        {
+            if (material.pieces[i] == PAWN ? !(occupied & squareBit(pos.sq[i] - 8))
+                                           : (tbPieceAttacks(material.pieces[i], pos.sq[i], occupied) & ~occupied) != 0)
+                return true;
+        }
+        return false;
+    }
+
+    void initialize(size_t index)
+    {
+        TbPosition pos = tbDecode(material, index);
+        uint64_t occupied = tbOccupied(material, pos);
+        uint8_t value = UNKNOWN;
+        if (!tbValid(material, pos, occupied) || tbIndex(material, pos) != index)
+            value = INVALID;
+        else if (pos.stm == BLACK)
+        {
+            uint64_t attacked = tbWhiteAttacks(material, pos, occupied ^ squareBit(pos.bk));
+            uint64_t targets = kingAttacks[pos.bk] & ~attacked;
+            if (targets & occupied)
+                value = DRAW; // Takes an undefended piece.
+            else if (!targets)
+                value = (attacked & squareBit(pos.bk)) ? 1 : DRAW;
+        }
+        else if (!whiteCanMove(pos, occupied))
+            value = DRAW;
+        else
+            exits[index] = uint8_t(promotionExit(pos, occupied));
+        values[index].store(value, memory_order_relaxed);
+    }
+
+    // White to move positions one move before `pos` (Black to move).
+    template <typename Visit>
+    void whiteUnmoves(const TbPosition &pos, uint64_t occupied, Visit visit) const
+    {
+        TbPosition prev = pos;
+        prev.stm = WHITE;
+        for (uint64_t from = kingAttacks[pos.wk] & ~occupied; from;)
+        {
+            prev.wk = popLsb(from);
+            visit(prev);
+        }
+        prev.wk = pos.wk;
+        for (int i = 0; i < material.count; i++)
+        {
+            int sq = pos.sq[i];
+            uint64_t from = 0;
+            if (material.pieces[i] != PAWN)
+                from = tbPieceAttacks(material.pieces[i], sq, occupied) & ~occupied;
+            else if (sq / 8 <= 5 && !(occupied & squareBit(sq + 8)))
+            {
+                from = squareBit(sq + 8);
+                if (sq / 8 == 4 && !(occupied & squareBit(sq + 16)))
+                    from |= squareBit(sq + 16);
+            }
+            while (from)
+            {
+                prev.sq[i] = popLsb(from);
+                visit(prev);
+            }
+            prev.sq[i] = sq;
+        }
+    }
+
+    // True if every Black move from `pos` reaches a decided White win.
+    bool allMovesLose(const TbPosition &pos) const
+    {
+        uint64_t occupied = tbOccupied(material, pos);
+        uint64_t targets = kingAttacks[pos.bk] & ~tbWhiteAttacks(material, pos, occupied ^ squareBit(pos.bk));
+        TbPosition next = pos;
+        next.stm = WHITE;
+        while (targets)
+        {
+            next.bk = popLsb(targets);
+            if (!isWin(values[tbIndex(material, next)].load(memory_order_relaxed)))
+                return false;
+        }
+        return true;
+    }
+
+    size_t winPass(int n)
+    {
+        size_t half = size / 2;
+        size_t found = forEach(half, size, [&](size_t index) {
+            if (values[index].load(memory_order_relaxed) != n)
+                return false;
+            TbPosition pos = tbDecode(material, index);
+            bool changed = false;
+            whiteUnmoves(pos, tbOccupied(material, pos), [&](const TbPosition &prev) {
+                changed |= settle(tbIndex(material, prev), n);
+            });
+            return changed;
+        });
+        return found + forEach(0, half, [&](size_t index) { return exits[index] == n && settle(index, n); });
+    }
+
+    size_t lossPass(int n)
+    {
+        return forEach(0, size / 2, [&](size_t index) {
+            if (values[index].load(memory_order_relaxed) != n)
+                return false;
+            TbPosition pos = tbDecode(material, index);
+            uint64_t occupied = tbOccupied(material, pos);
+            TbPosition prev = pos;
+            prev.stm = BLACK;
+            bool changed = false;
+            for (uint64_t from = kingAttacks[pos.bk] & ~occupied; from;)
+            {
+                prev.bk = popLsb(from);
+                size_t prevIndex = tbIndex(material, prev);
+                if (values[prevIndex].load(memory_order_relaxed) == UNKNOWN && allMovesLose(prev))
+                    changed |= settle(prevIndex, n);
+            }
+            return changed;
+        });
+    }
+
+public:
+    int maxDtm = 0;
+    size_t wins = 0, losses = 0, draws = 0;
+
+    TablebaseGenerator(const TbMaterial &table, const vector<vector<uint8_t>> &solved, int threadCount)
+        : material(table), finished(solved), threads(max(1, threadCount)), size(tbSize(table)),
+          values(new atomic<uint8_t>[size]), exits(size / 2, 0)
+    {
+    }
+
+    // Returns the DTM bytes in the file encoding.
+    vector<uint8_t> generate()
+    {
+        forEach(0, size, [&](size_t index) {
+            initialize(index);
+            return false;
+        });
+        int lastExit = *max_element(exits.begin(), exits.end());
+        int lastChange = 0;
+        for (int n = 1; n <= max(lastChange + 2, lastExit) && n < DRAW - 1; n++)
+            if ((n % 2 ? winPass(n) : lossPass(n)) > 0)
+                lastChange = n;
+
+        vector<uint8_t> dtm(size);
+        for (size_t i = 0; i < size; i++)
+        {
+            uint8_t value = values[i].load(memory_order_relaxed);
+            if (value == UNKNOWN || value == DRAW)
+                draws++;
+            if (value == UNKNOWN || value >= DRAW)
+                value = 0;
+            else
+            {
+                maxDtm = max(maxDtm, value - 1);
+                (isWin(value) ? wins : losses)++;
+            }
+            dtm[i] = value;
+        }
+        return dtm;
+    }
+};
+
+const char TB_MAGIC[4] = { 'C', 'B', 'T', 'B' };
+
+bool writeTablebase(const string &path, char kind, size_t entries, const vector<uint8_t> &data)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    uint8_t header[16] = {};
+    memcpy(header, TB_MAGIC, 4);
+    header[4] = uint8_t(kind);
+    uint64_t count = entries;
+    memcpy(header + 8, &count, 8);
+    bool ok = fwrite(header, 1, 16, file) == 16 && fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+// Generates every table into dir. Later tables read the earlier ones from memory.
+int runTablebaseGeneration(const string &dir, int threads)
+{
+    vector<vector<uint8_t>> finished;
+    for (const TbMaterial &material : tbMaterials)
+    {
+        auto start = chrono::steady_clock::now();
+        TablebaseGenerator generator(material, finished, threads);
+        vector<uint8_t> dtm = generator.generate();
+        vector<uint8_t> wdl((dtm.size() + 3) / 4, 0);
+        for (size_t i = 0; i < dtm.size(); i++)
+            if (dtm[i])
+                wdl[i / 4] |= ((dtm[i] - 1) % 2 ? 1 : 2) << (2 * (i % 4));
+        string base = dir + "/" + material.name;
+        if (!writeTablebase(base + ".dtm", 'D', dtm.size(), dtm) || !writeTablebase(base + ".wdl", 'W', dtm.size(), wdl))
+        {
+            cout << "Cannot write " << base << endl;
+            return 1;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << material.name << ": " << dtm.size() << " positions, " << generator.wins << " wins, " << generator.losses
+             << " losses, " << generator.draws << " draws, longest mate " << generator.maxDtm << " plies, "
+             << fixed << setprecision(2) << seconds << " s" << endl;
+        finished.push_back(move(dtm));
+    }
+    return 0;
+}
+
+// Read-only mappings of whatever tables a directory holds.
+class Tablebases
+{
+private:
+    struct Mapping
+    {
+        void *memory = nullptr;
+        size_t bytes = 0;
+        const uint8_t *data = nullptr;
+    };
+    Mapping dtm[TB_MATERIALS], wdl[TB_MATERIALS];
+
+    static bool map(const string &path, char kind, size_t entries, Mapping &mapping)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        void *memory = MAP_FAILED;
+        size_t bytes = 16 + (kind == 'D' ? entries : (entries + 3) / 4);
+        if (fstat(fd, &info) == 0 && size_t(info.st_size) == bytes)
+            memory = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            return false;
+        const uint8_t *header = static_cast<const uint8_t *>(memory);
+        uint64_t count;
+        memcpy(&count, header + 8, 8);
+        if (memcmp(header, TB_MAGIC, 4) != 0 || header[4] != kind || count != entries)
+        {
+            munmap(memory, bytes);
+            return false;
+        }
+        mapping.memory = memory;
+        mapping.bytes = bytes;
+        mapping.data = header + 16;
+        return true;
+    }
+
+    // Finds the table for the board and its position in the table's frame.
+    static int locate(const ChessBoard &board, TbPosition &pos)
+    {
+        const Bitboards &bb = board.getBitboards();
+        if (popCount(bb.allPieces) > 4 || board.getCastlingRights())
+            return -1;
+        Color strong = popCount(bb.whitePieces) > 1 ? WHITE : BLACK;
+        Color weak = strong == WHITE ? BLACK : WHITE;
+        int pieces = popCount(bb.occupancy(strong)) - 1;
+        if (popCount(bb.occupancy(weak)) != 1 || pieces < 1)
+            return -1;
+        int flip = strong == WHITE ? 0 : 56;
+        pos.wk = lsb(bb.pieces(KING, strong)) ^ flip;
+        pos.bk = lsb(bb.pieces(KING, weak)) ^ flip;
+        pos.stm = board.getSideToMove() == strong ? WHITE : BLACK;
+        for (int table = 0; table < TB_MATERIALS; table++)
+        {
+            const TbMaterial &material = tbMaterials[table];
+            bool match = material.count == pieces;
+            for (int i = 0; match && i < material.count; i++)
+            {
+                uint64_t set = bb.pieces(material.pieces[i], strong);
+                match = popCount(set) == 1;
+                pos.sq[i] = match ? lsb(set) ^ flip : 0;
+            }
+            if (match)
+                return table;
+        }
+        return -1;
+    }
+
+public:
+    int count = 0; // Tables with at least one file mapped.
+
+    Tablebases() = default;
+    Tablebases(const Tablebases &) = delete;
+    Tablebases &operator=(const Tablebases &) = delete;
+
+    ~Tablebases()
+    {
+        release();
+    }
+
+    void release()
+    {
+        for (Mapping *mapping : { dtm, wdl })
+            for (int table = 0; table < TB_MATERIALS; table++)
+            {
+                if (mapping[table].memory)
+                    munmap(mapping[table].memory, mapping[table].bytes);
+                mapping[table] = Mapping();
+            }
+        count = 0;
+    }
+
+    // Maps the .dtm and .wdl files found in dir; returns the number of tables.
+    int load(const string &dir)
+    {
+        release();
+        for (int table = 0; table < TB_MATERIALS; table++)
+        {
+            string base = dir + "/" + tbMaterials[table].name;
+            size_t entries = tbSize(tbMaterials[table]);
+            bool found = map(base + ".dtm", 'D', entries, dtm[table]);
+            found = map(base + ".wdl", 'W', entries, wdl[table]) || found;
+            count += found ? 1 : 0;
+        }
+        return count;
+    }
+
+    // Looks the position up: wdl is 1, 0 or -1 for the side to move and dtm
+    // the plies to mate, or -1 when only the WDL file is mapped. Castling
+    // rights and the fifty-move rule are not modelled by the tables.
+    bool probe(const ChessBoard &board, int &wdlValue, int &dtmValue) const
+    {
+        TbPosition pos;
+        int table = locate(board, pos);
+        if (table < 0 || (!dtm[table].data && !wdl[table].data))
+            return false;
+        size_t index = tbIndex(tbMaterials[table], pos);
+        if (dtm[table].data)
+        {
+            uint8_t value = dtm[table].data[index];
+            dtmValue = value ? value - 1 : -1;
+            wdlValue = !value ? 0 : (value - 1) % 2 ? 1 : -1;
+            return true;
+        }
+        int bits = (wdl[table].data[index / 4] >> (2 * (index % 4))) & 3;
+        wdlValue = bits == 1 ? 1 : bits == 2 ? -1 : 0;
+        dtmValue = -1;
+        return true;
+    }
+};
+
+Tablebases tablebases;
+
+// "tb generate <dir> [threads]" builds the tables; "tb probe <dir> <fen>"
+// prints the stored result of a position and of each of its legal moves.
+int runTablebaseCommand(const string &action, const string &dir, const string &arg)
+{
+    if (action == "generate")
+        return runTablebaseGeneration(dir, arg.empty() ? int(thread::hardware_concurrency()) : atoi(arg.c_str()));
+    if (action != "probe" || tablebases.load(dir) == 0)
+    {
+        cout << (action == "probe" ? "No tablebases in " + dir : "Unknown tb command " + action) << endl;
+        return 1;
+    }
+    ChessBoard board;
+    if (!board.loadFen(arg))
+    {
+        cout << "Invalid FEN: " << arg << endl;
+        return 1;
+    }
+    auto describe = [](int wdl, int dtm) {
+        string text = wdl > 0 ? "win" : wdl < 0 ? "loss" : "draw";
+        return dtm > 0 ? text + " in " + to_string(dtm) + " plies" : dtm == 0 && wdl ? string("mated") : text;
+    };
+    int wdl, dtm;
+    if (!tablebases.probe(board, wdl, dtm))
+    {
+        cout << "Position not in the tablebases" << endl;
+        return 1;
+    }
+    cout << "Position: " << describe(wdl, dtm) << endl;
+    MoveList moves = board.getLegalMoves(board.getSideToMove());
+    for (Move move : moves)
+    {
+        board.applyMove(move);
+        if (tablebases.probe(board, wdl, dtm))
+            cout << "  " << moveToString(move) << ": " << describe(-wdl, wdl && dtm >= 0 ? dtm + 1 : -1) << endl;
+        else
+            cout << "  " << moveToString(move) << ": draw (leaves the tables)" << endl;
+        board.undoMove(move);
+    }
+    return 0;
+}
+
+// --- Search ---
+// Principal variation search inside iterative deepening, with aspiration
+// windows at the root, null-move pruning and late move reductions.
+
+const int MAX_PLY = 128;
+const int INF_SCORE = 32001;
+const int MATE_SCORE = 32000;
+const int MATE_BOUND = MATE_SCORE - MAX_PLY; // Scores beyond this are mates.
+const int TB_WIN_SCORE = MATE_BOUND - 1;     // Tablebase win without a known distance.
+
+struct SearchLimits
+{
+    int depth = MAX_PLY - 1;
+    uint64_t nodes = 0;   // 0 = no node limit.
+    int64_t movetime = 0; // Milliseconds; 0 = not set.
+    int64_t time[3] = {}; // Remaining clock time per Color, milliseconds.
+    int64_t inc[3] = {};  // Increment per Color, milliseconds.
+    int movestogo = 0;    // 0 = sudden death.
+    bool infinite = false;
+    bool ponder = false;  // Search on the opponent's time until ponderhit.
+};
+
+// Turns the clock into two budgets: the soft limit decides whether another
+// iteration is worth starting, the hard limit aborts a search in progress.
+class TimeManager
+{
+private:
+    chrono::steady_clock::time_point startTime;
+    int64_t softLimit = 0, hardLimit = 0; // 0 = unlimited.
+
+public:
+    void start(const SearchLimits &limits, Color us)
+    {
+        startTime = chrono::steady_clock::now();
+        softLimit = hardLimit = 0;
+        if (limits.movetime)
+            softLimit = hardLimit = limits.movetime;
+        else if (limits.time[us] && !limits.infinite)
+        {
+            const int64_t overhead = 30; // Leave room for I/O and GUI lag.
+            int64_t available = max<int64_t>(limits.time[us] - overhead, 1);
+            int movesLeft = limits.movestogo ? min(limits.movestogo, 50) : 30;
+            softLimit = min(available / movesLeft + limits.inc[us] * 3 / 4, available / 2);
+            hardLimit = min(softLimit * 4, available * 4 / 5);
+            softLimit = max<int64_t>(softLimit, 1);
+            hardLimit = max(hardLimit, softLimit);
+        }
+    }
+
+    int64_t elapsed() const
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count();
+    }
+
+    bool softExpired() const
+    {
+        return softLimit && elapsed() >= softLimit;
+    }
+
+    bool hardExpired() const
+    {
+        return hardLimit && elapsed() >= hardLimit;
+    }
+};
+
+struct SearchResult
+{
+    Move bestMove = Move::none();
+    Move ponderMove = Move::none();
+    int score = 0;
+    int depth = 0;
+    uint64_t nodes = 0;
+    uint64_t pawnProbes = 0, pawnHits = 0;
+};
+
+// Hit rate of the pawn tables over a search, for the statistics line.
+string pawnHashStats(const SearchResult &result)
+{
+    ostringstream out;
+    out << "pawn hash hits " << result.pawnHits << "/" << result.pawnProbes;
+    if (result.pawnProbes)
+        out << " (" << fixed << setprecision(1) << 100.0 * result.pawnHits / result.pawnProbes << "%)";
+    return out.str();
+}
+
+// Reductions for late moves, indexed by remaining depth and move number.
+int lmrReductions[MAX_PLY][64];
+
+void initSearch()
+{
+    for (int depth = 1; depth < MAX_PLY; depth++)
+        for (int moveNumber = 1; moveNumber < 64; moveNumber++)
+            lmrReductions[depth][moveNumber] = int(0.75 + log(depth) * log(moveNumber) / 2.25);
+}
+
+// Mate scores are stored relative to the node rather than the root, so the same
+// entry stays correct wherever in the tree the position is reached.
+int scoreToTT(int score, int ply)
+{
+    return score >= MATE_BOUND ? score + ply : score <= -MATE_BOUND ? score - ply : score;
+}
+
+int scoreFromTT(int score, int ply)
+{
+    return score >= MATE_BOUND ? score - ply : score <= -MATE_BOUND ? score + ply : score;
+}
+
+string scoreToString(int score)
+{
+    if (abs(score) >= MATE_BOUND)
+        return "mate " + to_string(score > 0 ? (MATE_SCORE - score + 1) / 2 : -(MATE_SCORE + score) / 2);
+    return "cp " + to_string(score);
+}
+
+// Static exchange evaluation: true if the sequence of captures on the target
+// square that the move starts gains at least threshold for the mover, with
+// each side recapturing with its least valuable attacker and free to stop.
+// Attackers come from attackersTo with the occupancy shrinking as pieces
+// are traded off, so sliders behind the front attacker join in (x-rays).
+bool seeGE(const ChessBoard &board, Move move, int threshold)
+{
+    if (move.type() == CASTLING)
+        return 0 >= threshold;
+    const Bitboards &bb = board.getBitboards();
+    int from = move.from(), to = move.to();
+    Piece victim = move.type() == EN_PASSANT ? PAWN : board.pieceAt(to).piece;
+    Piece attacker = move.type() == PROMOTION ? move.promotedPiece() : board.pieceAt(from).piece;
+    int gain = pieceValues[victim] - threshold;
+    if (move.type() == PROMOTION)
+        gain += pieceValues[attacker] - pieceValues[PAWN];
+    if (gain < 0)
+        return false;
+    // Even if the moved piece is lost for nothing the exchange still holds.
+    gain = pieceValues[attacker] - gain;
+    if (gain <= 0)
+        return true;
+
+    uint64_t occupied = bb.allPieces ^ squareBit(from) ^ squareBit(to);
+    if (move.type() == EN_PASSANT)
+        occupied ^= squareBit(to + (board.pieceAt(from).color == WHITE ? 8 : -8));
+    uint64_t bishops = bb.whiteBishops | bb.blackBishops | bb.whiteQueens | bb.blackQueens;
+    uint64_t rooks = bb.whiteRooks | bb.blackRooks | bb.whiteQueens | bb.blackQueens;
+    uint64_t attackers = board.attackersTo(to, occupied) & occupied;
+    Color side = board.pieceAt(from).color;
+    bool result = true;
+    while (true)
+    {
+        side = side == WHITE ? BLACK : WHITE;
+        attackers &= occupied;
+        uint64_t ours = attackers & bb.occupancy(side);
+        if (!ours)
+            break;
+        result = !result;
+
+        Piece piece = PAWN;
+        while (!(ours & bb.pieces(piece, side)))
+            piece = Piece(piece + 1);
+        // The king may only take last: if the other side still has an
+        // attacker the capture would be illegal.
+        if (piece == KING)
+            return (attackers & ~bb.occupancy(side)) ? !result : result;
+        gain = pieceValues[piece] - gain;
+        if (gain < (result ? 1 : 0))
+            break;
+        occupied ^= squareBit(lsb(ours & bb.pieces(piece, side)));
+        if (piece == PAWN || piece == BISHOP || piece == QUEEN)
+            attackers |= bishopAttacks(to, occupied) & bishops;
+        if (piece == ROOK || piece == QUEEN)
+            attackers |= rookAttacks(to, occupied) & rooks;
+    }
+    return result;
+}
+
+// Hands out the moves of one node a stage at a time, so a cutoff early on
+// saves generating (and scoring) the rest: the hash move, then captures and
+// promotions by most valuable victim / least valuable attacker, then the
+// killer and counter moves, then the quiet moves by history, and last the
+// captures that lose material by SEE. In quiescence only the captures are
+// produced (all evasions when in check), losing ones included, for the
+// search to prune.
+class MovePicker
+{
+private:
+    enum Stage
+    {
+        TT_MOVE,
+        GEN_CAPTURES,
+        PICK_CAPTURES,
+        KILLER_1,
+        KILLER_2,
+        COUNTER_MOVE,
+        GEN_QUIETS,
+        PICK_QUIETS,
+        BAD_CAPTURES,
+        DONE
+    };
+
+    const ChessBoard &board;
+    Move ttMove, killer1, killer2, counterMove;
+    const int (*history)[64];
+    bool capturesOnly = false;
+    Stage stage = TT_MOVE;
+    MoveList moves, badCaptures;
+    int scores[256];
+    int index = 0;
+
+    bool isCapture(Move move) const
+    {
+        return board.pieceAt(move.to()).piece != EMPTY || move.type() == EN_PASSANT || move.type() == PROMOTION;
+    }
+
+    // A refutation move from another node is tried only if it is a legal quiet
+    // move here that has not been tried already.
+    bool usable(Move move) const
+    {
+        return move != Move::none() && move != ttMove && !isCapture(move) && board.isLegal(move);
+    }
+
+    // Selection sort one step at a time: at cut nodes most of the list is never sorted.
+    Move pickBest()
+    {
+        int best = index;
+        for (int i = index + 1; i < moves.size(); i++)
+            if (scores[i] > scores[best])
+                best = i;
+        swap(moves[index], moves[best]);
+        swap(scores[index], scores[best]);
+        return moves[index++];
+    }
+
+public:
+    MovePicker(const ChessBoard &position, Move hashMove, const Move killers[2], Move counter, const int (*quietHistory)[64])
+        : board(position), ttMove(hashMove), killer1(killers[0]), killer2(killers[1]), counterMove(counter),
+          history(quietHistory)
+    {
+        if (killer2 == killer1)
+            killer2 = Move::none();
+        if (counterMove == killer1 || counterMove == killer2)
+            counterMove = Move::none();
+    }
+
+    // Quiescence: captures only, unless the side to move is in check.
+    MovePicker(const ChessBoard &position, Move hashMove, bool inCheck)
+        : board(position), ttMove(hashMove), killer1(Move::none()), killer2(Move::none()),
+          counterMove(Move::none()), history(nullptr), capturesOnly(!inCheck)
+    {
+    }
+
+    // Returns Move::none() once every legal move has been handed out.
+    Move next()
+    {
+        switch (stage)
+        {
+        case TT_MOVE:
+            stage = GEN_CAPTURES;
+            if (ttMove != Move::none() && (!capturesOnly || isCapture(ttMove)) && board.isLegal(ttMove))
+                return ttMove;
+            ttMove = Move::none();
+            [[fallthrough]];
+        case GEN_CAPTURES:
+            moves = board.getLegalMoves(board.getSideToMove(), CAPTURES);
+            for (int i = 0; i < moves.size(); i++)
+            {
+                Move move = moves[i];
+                Piece victim = move.type() == EN_PASSANT ? PAWN : board.pieceAt(move.to()).piece;
+                int promotion = move.type() == PROMOTION ? pieceValues[move.promotedPiece()] : 0;
+                scores[i] = 10 * (pieceValues[victim] + promotion) - pieceValues[board.pieceAt(move.from()).piece];
+            }
+            index = 0;
+            stage = PICK_CAPTURES;
+            [[fallthrough]];
+        case PICK_CAPTURES:
+            while (index < moves.size())
+            {
+                Move move = pickBest();
+                if (move == ttMove)
+                    continue;
+                if (capturesOnly || seeGE(board, move, 0))
+                    return move;
+                badCaptures.add(move);
+            }
+            if (capturesOnly)
+            {
+                stage = DONE;
+                return Move::none();
+            }
+            stage = KILLER_1;
+            [[fallthrough]];
+        case KILLER_1:
+            stage = KILLER_2;
+            if (usable(killer1))
+                return killer1;
+            killer1 = Move::none();
+            [[fallthrough]];
+        case KILLER_2:
+            stage = COUNTER_MOVE;
+            if (usable(killer2))
+                return killer2;
+            killer2 = Move::none();
+            [[fallthrough]];
+        case COUNTER_MOVE:
+            stage = GEN_QUIETS;
+            if (usable(counterMove))
+                return counterMove;
+            counterMove = Move::none();
+            [[fallthrough]];
+        case GEN_QUIETS:
+            moves = board.getLegalMoves(board.getSideToMove(), QUIETS);
+            for (int i = 0; i < moves.size(); i++)
+                scores[i] = history ? history[moves[i].from()][moves[i].to()] : 0;
+            index = 0;
+            stage = PICK_QUIETS;
+            [[fallthrough]];
+        case PICK_QUIETS:
+            while (index < moves.size())
+            {
+                Move move = pickBest();
+                if (move != ttMove && move != killer1 && move != killer2 && move != counterMove)
+                    return move;
+            }
+            index = 0;
+            stage = BAD_CAPTURES;
+            [[fallthrough]];
+        case BAD_CAPTURES:
+            if (index < badCaptures.size())
+                return badCaptures[index++];
+            stage = DONE;
+            [[fallthrough]];
+        case DONE:
+            break;
+        }
+        return Move::none();
+    }
+};
+
+// Search output can come from a search thread while the UCI thread answers
+// commands, so whole lines are written under one lock.
+mutex outputLock;
+
+void sendLine(const string &line)
+{
+    lock_guard<mutex> guard(outputLock);
+    cout << line << endl;
+}
+
+// State shared by every thread of one search. The stop flag and the node
+// total are the only fields written while the threads run.
+struct SharedSearch
+{
+    atomic<bool> stop{ false };
+    atomic<uint64_t> nodes{ 0 }; // Flushed by each thread in batches of 1024.
+    atomic<bool> pondering{ false }; // No clock until ponderhit.
+    atomic<uint64_t> tbHits{ 0 };
+    SearchLimits limits;
+    uint64_t nodeLimit = 0;      // Per-thread share of limits.nodes.
+    TimeManager timer;
+    bool printOutput = false;
+    TranspositionTable *tt = &TT; // The match runner gives each engine its own.
+    bool classicalEval = false;   // Ignore a loaded network.
+
+    // Resets the flags for a search of position by the given number of threads.
+    void begin(const ChessBoard &position, const SearchLimits &searchLimits, bool print, int threads)
+    {
+        tt->newSearch();
+        stop = false;
+        pondering = searchLimits.ponder;
+        nodes = 0;
+        tbHits = 0;
+        limits = searchLimits;
+        nodeLimit = limits.nodes ? (limits.nodes + threads - 1) / threads : 0;
+        printOutput = print;
+        timer.start(limits, position.getSideToMove());
+    }
+};
+
+// One search thread. Each owns a copy of the board, its history table and the
+// PV stack, so the threads share nothing but the transposition table and the
+// SharedSearch flags. Thread 0 is the main thread: it alone manages the clock
+// and prints, and it stops the helpers when it finishes.
+class Searcher
+{
+private:
+    int id;
+    SharedSearch &shared;
+    ChessBoard board;
+    bool stopped = false;
+    uint64_t nodes = 0;
+    int selDepth = 0;
+    int64_t lastInfoTime = 0;
+    int lastInfoDepth = 0;
+    vector<Move> lastLine;
+    int history[3][64][64];  // Quiet move history by Color, from and to square.
+    Move killers[MAX_PLY + 1][2];  // Quiet moves that caused a cutoff at each ply.
+    Move counterMoves[64][64];     // Quiet refutation of the previous move, by its from and to.
+    NnueStack nnue{ MAX_PLY + 2 };
+    PawnTable pawnTable;
+
+    int staticEvaluation()
+    {
+        TELEMETRY_TIME(evalCalls, evalNanos);
+        return network.loaded && !shared.classicalEval ? nnue.evaluate(board) : evaluate(board, &pawnTable);
+    }
+    Move pv[MAX_PLY + 1][MAX_PLY + 1];
+    int pvLength[MAX_PLY + 1];
+
+    void checkLimits()
+    {
+        if ((nodes & 1023) == 0)
+        {
+            shared.nodes.fetch_add(1024, memory_order_relaxed);
+            if (id == 0 && !shared.pondering.load(memory_order_relaxed) && shared.timer.hardExpired())
+                shared.stop = true;
+        }
+        if (shared.stop.load(memory_order_relaxed) || (shared.nodeLimit && nodes >= shared.nodeLimit))
+            stopped = true;
+    }
+
+    bool isCapture(Move move) const
+    {
+        return board.pieceAt(move.to()).piece != EMPTY || move.type() == EN_PASSANT;
+    }
+
+    // A quiet move that caused a cutoff becomes a killer at this ply and the
+    // counter move to the previous move; its history goes up and that of the
+    // quiet moves tried before it goes down.
+    void updateQuietStats(int ply, int depth, Move move, const Move quietsTried[], int quietCount)
+    {
+        Color us = board.getSideToMove();
+        if (killers[ply][0] != move)
+        {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = move;
+        }
+        Move previous = board.lastMove();
+        if (previous != Move::none())
+            counterMoves[previous.from()][previous.to()] = move;
+        int bonus = min(depth * depth, 1200);
+        updateHistory(us, move, bonus);
+        for (int i = 0; i < quietCount; i++)
+            updateHistory(us, quietsTried[i], -bonus);
+    }
+
+    // Gravity update: entries saturate towards +-16384 instead of overflowing.
+    void updateHistory(Color us, Move move, int bonus)
+    {
+        int &entry = history[us][move.from()][move.to()];
+        entry += bonus - entry * abs(bonus) / 16384;
+    }
+
+    // Resolves captures before trusting the static evaluation. The side to
+    // move may stand pat on the evaluation (it is never forced to capture);
+    // captures that cannot raise alpha even by winning the victim for free,
+    // or that lose material by SEE, are skipped. In check every evasion is
+    // searched, since standing pat there would ignore the threat.
+    int quiescence(int alpha, int beta, int ply)
+    {
+        pvLength[ply] = ply;
+        nodes++;
+        TELEMETRY_COUNT(qnodes);
+        checkLimits();
+        if (stopped)
+            return 0;
+        selDepth = max(selDepth, ply);
+        if (ply >= MAX_PLY)
+            return staticEvaluation();
+
+        TTData tt;
+        bool ttHit = shared.tt->probe(board.getKey(), tt);
+        if (ttHit)
+        {
+            int ttScore = scoreFromTT(tt.score, ply);
+            if (tt.bound == BOUND_EXACT || (tt.bound == BOUND_LOWER && ttScore >= beta) ||
+                (tt.bound == BOUND_UPPER && ttScore <= alpha))
+                return ttScore;
+        }
+
+        Color us = board.getSideToMove();
+        bool inCheck = board.isKingInCheck(us);
+        int staticEval = -INF_SCORE, bestScore = -INF_SCORE;
+        if (!inCheck)
+        {
+            staticEval = bestScore = ttHit ? tt.eval : staticEvaluation();
+            if (bestScore >= beta)
+                return bestScore;
+            alpha = max(alpha, bestScore);
+        }
+
+        const int deltaMargin = 200;
+        int originalAlpha = alpha, moveCount = 0;
+        Move bestMove = Move::none();
+        MovePicker picker(board, ttHit ? tt.move : Move::none(), inCheck);
+        for (Move move = picker.next(); move != Move::none(); move = picker.next())
+        {
+            moveCount++;
+            if (!inCheck)
+            {
+                Piece victim = move.type() == EN_PASSANT ? PAWN : board.pieceAt(move.to()).piece;
+                if (move.type() != PROMOTION && staticEval + pieceValues[victim] + deltaMargin <= alpha)
+                    continue;
+                if (!seeGE(board, move, 0))
+                    continue;
+            }
+            board.applyMove(move);
+            int score = -quiescence(-beta, -alpha, ply + 1);
+            board.undoMove(move);
+            if (stopped)
+                return 0;
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestMove = move;
+                if (score > alpha)
+                {
+                    alpha = score;
+                    if (alpha >= beta)
+                        break;
+                }
+            }
+        }
+        if (inCheck && moveCount == 0)
+            return -MATE_SCORE + ply;
+
+        Bound bound = bestScore >= beta ? BOUND_LOWER : bestScore > originalAlpha ? BOUND_EXACT : BOUND_UPPER;
+        shared.tt->store(board.getKey(), bestMove, scoreToTT(bestScore, ply), staticEval, 0, bound);
+        return bestScore;
+    }
+
+    int search(int alpha, int beta, int depth, int ply, bool allowNull)
+    {
+        bool pvNode = beta - alpha > 1;
+        pvLength[ply] = ply;
+        // Tablebase positions are settled exactly, with mate distances when the
+        // DTM file is mapped; the root is left to the search so it has a move.
+        int wdl, dtm;
+        if (ply > 0 && tablebases.count && tablebases.probe(board, wdl, dtm))
+        {
+            shared.tbHits.fetch_add(1, memory_order_relaxed);
+            if (wdl == 0)
+                return 0;
+            if (dtm < 0)
+                return wdl > 0 ? TB_WIN_SCORE - ply : -TB_WIN_SCORE + ply;
+            return wdl > 0 ? MATE_SCORE - ply - dtm : -MATE_SCORE + ply + dtm;
+        }
+        if (depth <= 0 || ply >= MAX_PLY)
+            return ply >= MAX_PLY ? staticEvaluation() : quiescence(alpha, beta, ply);
+
+        nodes++;
+        TELEMETRY_COUNT(nodes);
+        checkLimits();
+        if (stopped)
+            return 0;
+        selDepth = max(selDepth, ply);
+
+        Color us = board.getSideToMove();
+        if (ply > 0)
+        {
+            if (board.isRepetition() || board.getHalfmoveClock() >= 100)
+                return 0;
+            // No line from here can beat a mate that was already found closer to the root.
+            alpha = max(alpha, -MATE_SCORE + ply);
+            beta = min(beta, MATE_SCORE - ply - 1);
+            if (alpha >= beta)
+                return alpha;
+        }
+
+        TTData tt;
+        bool ttHit = shared.tt->probe(board.getKey(), tt);
+        Move ttMove = ttHit ? tt.move : Move::none();
+        if (ttHit && !pvNode && tt.depth >= depth)
+        {
+            int ttScore = scoreFromTT(tt.score, ply);
+            if (tt.bound == BOUND_EXACT || (tt.bound == BOUND_LOWER && ttScore >= beta) ||
+                (tt.bound == BOUND_UPPER && ttScore <= alpha))
+                return ttScore;
+        }
+
+        bool inCheck = board.isKingInCheck(us);
+        int staticEval = inCheck ? -INF_SCORE : (ttHit ? tt.eval : staticEvaluation());
+
+        // Null move: if passing still fails high at reduced depth, a real move almost
+        // certainly would too. Skipped without pieces, where zugzwang is common.
+        const Bitboards &bb = board.getBitboards();
+        bool hasPieces = bb.occupancy(us) & ~(bb.pieces(PAWN, us) | bb.pieces(KING, us));
+        if (!pvNode && !inCheck && allowNull && depth >= 3 && staticEval >= beta && hasPieces)
+        {
+            int reduction = 3 + depth / 4;
+            board.applyNullMove();
+            int score = -search(-beta, -beta + 1, depth - 1 - reduction, ply + 1, false);
+            board.undoNullMove();
+            if (stopped)
+                return 0;
+            if (score >= beta)
+                return score >= MATE_BOUND ? beta : score;
+        }
+
+        Move previous = board.lastMove();
+        Move counter = previous != Move::none() ? counterMoves[previous.from()][previous.to()] : Move::none();
+        MovePicker picker(board, ttMove, killers[ply], counter, history[us]);
+        int bestScore = -INF_SCORE, originalAlpha = alpha;
+        Move bestMove = Move::none();
+        Move quietsTried[64];
+        int quietCount = 0, moveCount = 0;
+        for (Move move = picker.next(); move != Move::none(); move = picker.next())
+        {
+            int i = moveCount++;
+            bool quiet = !isCapture(move) && move.type() != PROMOTION;
+
+            board.applyMove(move);
+            bool givesCheck = board.isKingInCheck(board.getSideToMove());
+            // Check extension: a checking sequence is searched one ply deeper.
+            int newDepth = depth - 1 + (givesCheck ? 1 : 0);
+            int score;
+            if (i == 0)
+                score = -search(-beta, -alpha, newDepth, ply + 1, true);
+            else
+            {
+                // Late quiet moves are searched at reduced depth with a null window
+                // and only re-searched if they unexpectedly beat alpha.
+                int reduction = 0;
+                if (depth >= 3 && i >= 3 && quiet && !inCheck && !givesCheck)
+                    reduction = min(lmrReductions[min(depth, MAX_PLY - 1)][min(i, 63)] + (pvNode ? 0 : 1), newDepth - 1);
+                score = -search(-alpha - 1, -alpha, newDepth - reduction, ply + 1, true);
+                if (score > alpha && reduction > 0)
+                    score = -search(-alpha - 1, -alpha, newDepth, ply + 1, true);
+                if (score > alpha && score < beta)
+                    score = -search(-beta, -alpha, newDepth, ply + 1, true);
+            }
+            board.undoMove(move);
+            if (stopped)
+                return 0;
+
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestMove = move;
+                if (score > alpha)
+                {
+                    alpha = score;
+                    pv[ply][ply] = move;
+                    for (int j = ply + 1; j < pvLength[ply + 1]; j++)
+                        pv[ply][j] = pv[ply + 1][j];
+                    pvLength[ply] = pvLength[ply + 1];
+                    if (alpha >= beta)
+                    {
+                        TELEMETRY_COUNT(cutoffs);
+                        if (i == 0)
+                            TELEMETRY_COUNT(firstMoveCutoffs);
+                        break;
+                    }
+                }
+            }
+            if (quiet && quietCount < 64)
+                quietsTried[quietCount++] = move;
+        }
+
+        if (moveCount == 0)
+            return inCheck ? -MATE_SCORE + ply : 0;
+        if (bestScore >= beta && !isCapture(bestMove) && bestMove.type() != PROMOTION)
+            updateQuietStats(ply, depth, bestMove, quietsTried, quietCount);
+
+        Bound bound = bestScore >= beta ? BOUND_LOWER : bestScore > originalAlpha ? BOUND_EXACT : BOUND_UPPER;
+        shared.tt->store(board.getKey(), bestMove, scoreToTT(bestScore, ply), staticEval, depth, bound);
+        return bestScore;
+    }
+
+    // Fast iterations would flood stdout, so lines closer together than
+    // infoInterval are held back; the last completed depth is always printed.
+    void printInfo(int depth, int score, const vector<Move> &line, bool force)
+    {
+        const int64_t infoInterval = 20;
+        int64_t ms = shared.timer.elapsed();
+        if (!force && lastInfoDepth > 0 && ms - lastInfoTime < infoInterval)
+            return;
+        lastInfoTime = ms;
+        lastInfoDepth = depth;
+        uint64_t total = shared.nodes.load(memory_order_relaxed) + (nodes & 1023);
+        ostringstream out;
+        out << "info depth " << depth << " seldepth " << selDepth << " score " << scoreToString(score)
+            << " nodes " << total << " nps " << total * 1000 / max<int64_t>(ms, 1) << " time " << ms
+            << " hashfull " << shared.tt->hashfull();
+        if (uint64_t hits = shared.tbHits.load(memory_order_relaxed))
+            out << " tbhits " << hits;
+        out << " pv";
+        for (Move move : line)
+            out << " " << moveToString(move);
+        sendLine(out.str());
+    }
+
+public:
+    SearchResult result; // Last completed iteration of this thread.
+
+    Searcher(int threadId, SharedSearch &sharedState) : id(threadId), shared(sharedState) {}
+
+    void prepare(const ChessBoard &position)
+    {
+        board = position;
+        nnue.reset(board);
+        stopped = false;
+        nodes = 0;
+        pawnTable.probes = pawnTable.hits = 0;
+        lastInfoTime = lastInfoDepth = 0;
+        result = SearchResult();
+        memset(history, 0, sizeof(history));
+        for (auto &plyKillers : killers)
+            plyKillers[0] = plyKillers[1] = Move::none();
+        for (auto &row : counterMoves)
+            for (Move &move : row)
+                move = Move::none();
+    }
+
+    // Iterative deepening: each completed depth seeds the next through the
+    // transposition table, and the last completed one supplies the answer.
+    // Helpers with odd ids start one ply deeper so the threads spread over
+    // neighbouring depths instead of all repeating the same search.
+    void think()
+    {
+        MoveList rootMoves = board.getLegalMoves(board.getSideToMove());
+        if (rootMoves.size() > 0)
+            result.bestMove = rootMoves[0];
+
+        int previousScore = 0;
+#ifdef TELEMETRY
+        uint64_t iterationStart = nodes, previousIterationNodes = 0;
+#endif
+        int maxDepth = min(shared.limits.depth, MAX_PLY - 1);
+        for (int depth = 1 + (id & 1); rootMoves.size() > 0 && depth <= maxDepth; depth++)
+        {
+            selDepth = 0;
+            // Aspiration window: search a narrow window around the last score and
+            // widen it only on the side that fails.
+            int delta = 25;
+            int alpha = -INF_SCORE, beta = INF_SCORE;
+            if (depth >= 5)
+            {
+                alpha = max(previousScore - delta, -INF_SCORE);
+                beta = min(previousScore + delta, INF_SCORE);
+            }
+            int score;
+            while (true)
+            {
+                score = search(alpha, beta, depth, 0, false);
+                if (stopped)
+                    break;
+                if (score <= alpha)
+                {
+                    beta = (alpha + beta) / 2;
+                    alpha = max(score - delta, -INF_SCORE);
+                }
+                else if (score >= beta)
+                    beta = min(score + delta, INF_SCORE);
+                else
+                    break;
+                delta += delta / 2;
+            }
+            if (stopped)
+                break;
+
+            previousScore = score;
+#ifdef TELEMETRY
+            uint64_t iterationNodes = nodes - iterationStart;
+            if (previousIterationNodes > 0)
+            {
+                telemetry.iterations++;
+                telemetry.branchingSum += double(iterationNodes) / previousIterationNodes;
+            }
+            previousIterationNodes = iterationNodes;
+            iterationStart = nodes;
+#endif
+            lastLine.assign(pv[0], pv[0] + pvLength[0]);
+            result.bestMove = lastLine.empty() ? result.bestMove : lastLine[0];
+            result.ponderMove = lastLine.size() > 1 ? lastLine[1] : Move::none();
+            result.score = score;
+            result.depth = depth;
+            if (id == 0 && shared.printOutput)
+                printInfo(depth, score, lastLine, false);
+            if (id == 0 && !shared.pondering && shared.timer.softExpired())
+                break;
+        }
+        shared.nodes.fetch_add(nodes & 1023, memory_order_relaxed);
+        result.nodes = nodes;
+        result.pawnProbes = pawnTable.probes;
+        result.pawnHits = pawnTable.hits;
+        telemetryFlush();
+        if (id != 0)
+            return;
+        if (shared.printOutput && result.depth > lastInfoDepth)
+            printInfo(result.depth, result.score, lastLine, true);
+        // The protocol forbids answering "go infinite" or "go ponder" before
+        // stop or ponderhit, even when the search has nothing left to do.
+        while (!shared.stop && (shared.limits.infinite || shared.pondering))
+            this_thread::sleep_for(chrono::milliseconds(1));
+        shared.stop = true;
+    }
+};
+
+// Lazy SMP: every thread searches the same root against the shared
+// transposition table. The threads are created once and sleep between
+// searches; startSearch wakes them and wait blocks until all are idle again.
+class ThreadPool
+{
+private:
+    SharedSearch shared;
+    vector<unique_ptr<Searcher>> searchers;
+    vector<thread> threads;
+    mutex lock;
+    condition_variable signal;
+    uint64_t generation = 0; // Bumped once per search to wake the threads.
+    int running = 0;
+    bool exiting = false;
+    function<void(const SearchResult &)> onFinish;
+
+    // The answer of the thread that completed the deepest iteration, preferring
+    // the main thread on ties. Called with the lock held and all threads idle.
+    SearchResult bestResult() const
+    {
+        if (searchers.empty())
+            return SearchResult();
+        SearchResult best = searchers[0]->result;
+        uint64_t total = 0, probes = 0, hits = 0;
+        for (auto &searcher : searchers)
+        {
+            total += searcher->result.nodes;
+            probes += searcher->result.pawnProbes;
+            hits += searcher->result.pawnHits;
+            if (searcher->result.depth > best.depth && searcher->result.bestMove != Move::none())
+                best = searcher->result;
+        }
+        best.nodes = total;
+        best.pawnProbes = probes;
+        best.pawnHits = hits;
+        return best;
+    }
+
+    void idleLoop(int id, uint64_t seen)
+    {
+        while (true)
+        {
+            unique_lock<mutex> guard(lock);
+            signal.wait(guard, [&] { return exiting || generation != seen; });
+            if (exiting)
+                return;
+            seen = generation;
+            guard.unlock();
+
+            searchers[id]->think();
+
+            guard.lock();
+            if (--running == 0)
+            {
+                if (onFinish)
+                    onFinish(bestResult());
+                signal.notify_all();
+            }
+        }
+    }
+
+public:
+    ~ThreadPool()
+    {
+        setThreadCount(0);
+    }
+
+    int size() const
+    {
+        return (int)searchers.size();
+    }
+
+    // Joins the current threads and starts count fresh ones (with fresh state).
+    void setThreadCount(int count)
+    {
+        wait();
+        {
+            lock_guard<mutex> guard(lock);
+            exiting = true;
+        }
+        signal.notify_all();
+        for (thread &t : threads)
+            t.join();
+        threads.clear();
+        searchers.clear();
+        exiting = false;
+        for (int i = 0; i < count; i++)
+            searchers.push_back(make_unique<Searcher>(i, shared));
+        for (int i = 0; i < count; i++)
+            threads.emplace_back(&ThreadPool::idleLoop, this, i, generation);
+    }
+
+    // Returns at once; the search runs on the pool threads. If given, finished
+    // is called on the last thread to stop, before wait returns.
+    void startSearch(const ChessBoard &position, const SearchLimits &limits, bool printOutput,
+                     function<void(const SearchResult &)> finished = nullptr)
+    {
+        wait();
+        onFinish = finished;
+        shared.begin(position, limits, printOutput, size());
+        for (auto &searcher : searchers)
+            searcher->prepare(position);
+        {
+            lock_guard<mutex> guard(lock);
+            running = size();
+            generation++;
+        }
+        signal.notify_all();
+    }
+
+    void stop()
+    {
+        shared.stop = true;
+    }
+
+    // The opponent played the expected move: the clock now applies.
+    void ponderhit()
+    {
+        shared.pondering = false;
+    }
+
+    // Blocks until every thread is idle and returns the search result.
+    SearchResult wait()
+    {
+        unique_lock<mutex> guard(lock);
+        signal.wait(guard, [&] { return running == 0; });
+        return bestResult();
+    }
+
+    SearchResult think(const ChessBoard &position, const SearchLimits &limits, bool printOutput)
+    {
+        startSearch(position, limits, printOutput);
+        return wait();
+    }
+};
+
+ThreadPool Threads;
+
+// Lazy SMP scaling: searches a fixed set of positions to a fixed depth at
+// 1, 2, 4, ... threads with a cleared hash each time, and reports the node
+// rate and the time to depth relative to one thread.
+int runSmpBench(int depth, int maxThreads)
+{
+    const char *fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+    cout << "Lazy SMP scaling, depth " << depth << ", " << thread::hardware_concurrency() << " hardware threads\n"
+         << setw(8) << "threads" << setw(14) << "nodes" << setw(10) << "ms" << setw(12) << "nps"
+         << setw(10) << "nps x" << setw(10) << "ttd x" << endl;
+    double baseNps = 0, baseTime = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        Threads.setThreadCount(threads);
+        uint64_t nodes = 0;
+        auto start = chrono::steady_clock::now();
+        for (const char *fen : fens)
+        {
+            ChessBoard board;
+            board.loadFen(fen);
+            TT.clear(threads);
+            SearchLimits limits;
+            limits.depth = depth;
+            nodes += Threads.think(board, limits, false).nodes;
+        }
+        double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+        double nps = nodes / seconds;
+        if (threads == 1)
+        {
+            baseNps = nps;
+            baseTime = seconds;
+        }
+        cout << setw(8) << threads << setw(14) << nodes << setw(10) << (int64_t)(seconds * 1000) << setw(12)
+             << (uint64_t)nps << setw(10) << fixed << setprecision(2) << nps / baseNps << setw(10)
+             << baseTime / seconds << endl;
+    }
+    Threads.setThreadCount(1);
+    return 0;
+}
+
+// Parses UCI-style "go" parameters (depth, nodes, movetime, wtime, btime, winc,
+// binc, movestogo, infinite, ponder); anything unrecognised is left in the stream.
+SearchLimits parseLimits(istringstream &iss)
+{
+    SearchLimits limits;
+    string token;
+    streampos last = iss.tellg();
+    while (iss >> token)
+    {
+        if (token == "depth")
+            iss >> limits.depth;
+        else if (token == "nodes")
+            iss >> limits.nodes;
+        else if (token == "movetime")
+            iss >> limits.movetime;
+        else if (token == "wtime")
+            iss >> limits.time[WHITE];
+        else if (token == "btime")
+            iss >> limits.time[BLACK];
+        else if (token == "winc")
+            iss >> limits.inc[WHITE];
+        else if (token == "binc")
+            iss >> limits.inc[BLACK];
+        else if (token == "movestogo")
+            iss >> limits.movestogo;
+        else if (token == "infinite")
+            limits.infinite = true;
+        else if (token == "ponder")
+            limits.ponder = true;
+        else
+        {
+            iss.clear();
+            iss.seekg(last);
+            break;
+        }
+        last = iss.tellg();
+    }
+    return limits;
+}
+
+// --- EPD Batch ---
+// Streams an EPD (or FEN-per-line) file one line at a time, so memory stays
+// constant however large the file, and runs perft, the static evaluation or a
+// fixed-depth search on every position. Perft lines carrying ";D<n> <count>"
+// operations are checked against the expected count.
+
+// Splits an EPD line into a FEN (clocks appended when the line has none) and
+// the operation text after the four position fields.
+bool splitEpd(const string &line, string &fen, string &operations)
+{
+    istringstream iss(line.substr(0, line.find(';')));
+    vector<string> fields;
+    string token;
+    while (fields.size() < 6 && iss >> token)
+        fields.push_back(token);
+    if (fields.size() < 4)
+        return false;
+    bool hasClocks = fields.size() == 6 && all_of(fields[4].begin(), fields[4].end(), ::isdigit) &&
+                     all_of(fields[5].begin(), fields[5].end(), ::isdigit);
+    fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3] + (hasClocks ? " " + fields[4] + " " + fields[5] : "");
+    size_t skip = 0, pos = 0;
+    for (size_t fieldCount = hasClocks ? 6 : 4; skip < fieldCount; skip++)
+    {
+        pos = line.find_first_not_of(" \t", pos);
+        pos = line.find_first_of(" \t", pos);
+    }
+    operations = pos == string::npos ? "" : line.substr(pos);
+    return true;
+}
+
+int runEpdBatch(const string &path, const string &mode, int depth)
+{
+    ifstream file;
+    if (path != "-")
+    {
+        file.open(path);
+        if (!file)
+        {
+            cout << "Cannot open " << path << endl;
+            return 1;
+        }
+    }
+    istream &in = path == "-" ? cin : file;
+    if (mode != "perft" && mode != "eval" && mode != "search")
+    {
+        cout << "Unknown EPD mode " << mode << " (perft, eval or search)" << endl;
+        return 1;
+    }
+
+    uint64_t positions = 0, nodes = 0, invalid = 0, failures = 0, lineNumber = 0;
+    string line, fen, operations;
+    ChessBoard board;
+    auto start = chrono::steady_clock::now();
+    while (getline(in, line))
+    {
+        lineNumber++;
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (!splitEpd(line, fen, operations) || !board.loadFen(fen))
+        {
+            cout << lineNumber << ": invalid position" << endl;
+            invalid++;
+            continue;
+        }
+        positions++;
+        ostringstream out;
+        out << lineNumber << ": ";
+        if (mode == "perft")
+        {
+            uint64_t count = perft(board, depth);
+            nodes += count;
+            out << count;
+            size_t pos = operations.find("D" + to_string(depth) + " ");
+            if (pos != string::npos && (pos == 0 || operations[pos - 1] == ';' || isspace(operations[pos - 1])))
+            {
+                uint64_t expected = stoull(operations.substr(pos + 2 + to_string(depth).size()));
+                out << (count == expected ? "  ok" : "  FAIL (expected " + to_string(expected) + ")");
+                failures += count != expected;
+            }
+        }
+        else if (mode == "eval")
+            out << (network.loaded ? nnueEvaluateFresh(board) : evaluate(board));
+        else
+        {
+            SearchLimits limits;
+            limits.depth = depth;
+            SearchResult result = Threads.think(board, limits, false);
+            nodes += result.nodes;
+            out << (result.bestMove == Move::none() ? "0000" : moveToString(result.bestMove)) << " "
+                << scoreToString(result.score);
+        }
+        cout << out.str() << '\n';
+    }
+    double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+    cout << "\nPositions " << positions << "  invalid " << invalid;
+    if (mode == "perft")
+        cout << "  failed " << failures;
+    cout << "  time " << fixed << setprecision(3) << seconds << " s  positions/s "
+         << (uint64_t)(positions / seconds);
+    if (mode != "eval")
+        cout << "  nodes " << nodes << "  nps " << (uint64_t)(nodes / seconds);
+    cout << endl;
+    if (telemetryEnabled)
+        cout << telemetrySnapshot().toJson() << endl;
+    return failures || invalid ? 1 : 0;
+}
+
+// --- NNUE Checks ---
+// "nnue verify" walks three plies of the perft positions, evaluating every
+// node through the incremental accumulators the way the search does, and
+// compares each result with a from-scratch evaluation by the scalar kernels.
+// "nnue bench" times the same walk incrementally and from scratch.
+
+enum NnueWalkMode
+{
+    NNUE_VERIFY,
+    NNUE_INCREMENTAL,
+    NNUE_FRESH
+};
+
+void nnueWalk(ChessBoard &board, int depth, NnueStack &stack, NnueWalkMode mode, uint64_t &nodes, int64_t &sum)
+{
+    int score = mode == NNUE_FRESH ? nnueEvaluateFresh(board) : stack.evaluate(board);
+    nodes++;
+    if (mode == NNUE_VERIFY && score != nnueEvaluateFresh(board, true))
+    {
+        if (sum++ < 5)
+            cout << "mismatch at " << board.toFen() << endl;
+    }
+    else if (mode != NNUE_VERIFY)
+        sum += score;
+    if (depth == 0)
+        return;
+    for (Move move : board.getLegalMoves(board.getSideToMove()))
+    {
+        board.applyMove(move);
+        nnueWalk(board, depth - 1, stack, mode, nodes, sum);
+        board.undoMove(move);
+    }
+}
+
+int runNnueCommand(const string &action, const string &path)
+{
+    if (action == "write-test")
+    {
+        network.loadTestNetwork();
+        if (path.empty() || !network.save(path))
+        {
+            cout << "Cannot write " << path << endl;
+            return 1;
+        }
+        cout << "Wrote the built-in test network to " << path << endl;
+        return 0;
+    }
+    if (path.empty())
+        network.loadTestNetwork();
+    else if (!network.load(path))
+    {
+        cout << "Cannot load network " << path << endl;
+        return 1;
+    }
+    cout << "Network " << (path.empty() ? "built-in test net" : path) << ", kernels " << simdName() << endl;
+
+    NnueStack stack(16);
+    for (NnueWalkMode mode : { NNUE_VERIFY, NNUE_INCREMENTAL, NNUE_FRESH })
+    {
+        if ((mode == NNUE_VERIFY) != (action == "verify"))
+            continue;
+        uint64_t nodes = 0;
+        int64_t sum = 0; // Mismatch count when verifying, else a checksum.
+        auto start = chrono::steady_clock::now();
+        for (const PerftCase &test : perftSuite)
+        {
+            ChessBoard board;
+            board.loadFen(test.fen);
+            stack.reset(board);
+            nnueWalk(board, 3, stack, mode, nodes, sum);
+        }
+        double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+        if (mode == NNUE_VERIFY)
+        {
+            cout << "Checked " << nodes << " positions, " << sum << " mismatches" << endl;
+            return sum ? 1 : 0;
+        }
+        cout << (mode == NNUE_INCREMENTAL ? "Incremental:  " : "From scratch: ") << nodes << " evals  "
+             << (uint64_t)(nodes / seconds) << " evals/s  checksum " << sum << endl;
+    }
+    return 0;
+}
+
+// --- PGN Pipeline ---
+// PgnReader streams a PGN file through a fixed-size buffer and hands out one
+// game's text at a time. runPgnPipeline spreads batches of games over worker
+// threads that parse the SAN moves against the legal move generator and
+// replay them; the queue between them is bounded, so memory use does not
+// grow with the size of the file.
+
+class PgnReader
+{
+private:
+    static const size_t CHUNK = 1 << 22;
+    int fd = -1;
+    bool eof = false;
+    vector<char> buffer;
+    size_t begin = 0, end = 0; // Unread bytes.
+    size_t lastLine = 0;       // Bytes taken by the last line, to give it back.
+
+    // Next line without its newline, or false at the end of the input. The
+    // line stays valid until the following call.
+    bool readLine(const char *&line, size_t &length)
+    {
+        while (true)
+        {
+            const char *newline = static_cast<const char *>(memchr(buffer.data() + begin, '\n', end - begin));
+            if (newline || (eof && begin < end))
+            {
+                line = buffer.data() + begin;
+                length = newline ? newline - line : end - begin;
+                lastLine = length + (newline ? 1 : 0);
+                begin += lastLine;
+                bytes += lastLine;
+                if (length && line[length - 1] == '\r')
+                    length--;
+                return true;
+            }
+            if (eof)
+                return false;
+            // Keep the partial line, growing the buffer only for a line longer than it.
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            ssize_t got = read(fd, buffer.data() + end, buffer.size() - end);
+            if (got <= 0)
+                eof = true;
+            else
+                end += got;
+        }
+    }
+
+public:
+    uint64_t bytes = 0; // Consumed so far.
+
+    PgnReader() : buffer(CHUNK) {}
+    PgnReader(const PgnReader &) = delete;
+    PgnReader &operator=(const PgnReader &) = delete;
+
+    ~PgnReader()
+    {
+        if (fd > 0)
+            close(fd);
+    }
+
+    // "-" reads standard input.
+    bool open(const string &path)
+    {
+        fd = path == "-" ? 0 : ::open(path.c_str(), O_RDONLY);
+        if (fd > 0)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return fd >= 0;
+    }
+
+    // The text of the next game: its tag section and movetext. A tag line
+    // after movetext starts the next game.
+    bool next(string &game)
+    {
+        game.clear();
+        bool inMoves = false;
+        const char *line;
+        size_t length;
+        while (true)
+        {
+            if (!readLine(line, length))
+                break;
+            bool tag = length && line[0] == '[';
+            if (tag && inMoves)
+            {
+                begin -= lastLine;
+                bytes -= lastLine;
+                break;
+            }
+            inMoves = inMoves || (!tag && any_of(line, line + length, [](char c) { return !isspace(c); }));
+            game.append(line, length);
+            game += '\n';
+        }
+        return inMoves;
+    }
+};
+
+struct PgnGame
+{
+    string fen; // Start position; startFen unless the game has a FEN tag.
+    vector<string> moves;
+    int result = 2; // 1, 0 or -1 from White's side; 2 when unknown.
+};
+
+// Splits a game's text into its start position, SAN moves and result.
+// Comments, variations, NAGs and tags other than FEN are skipped.
+void parsePgnGame(const string &text, PgnGame &game)
+{
+    game.fen = startFen;
+    game.moves.clear();
+    game.result = 2;
+    istringstream in(text);
+    string line, token;
+    int comment = 0, variation = 0;
+    while (getline(in, line))
+    {
+        if (!comment && !variation && !line.empty() && line[0] == '[')
+        {
+            size_t open = line.find('"'), close = line.rfind('"');
+            if (line.compare(0, 5, "[FEN ") == 0 && open < close)
+                game.fen = line.substr(open + 1, close - open - 1);
+            continue;
+        }
+        istringstream tokens(line);
+        while (tokens >> token)
+        {
+            for (char c : token)
+            {
+                comment += c == '{' ? 1 : c == '}' ? -1 : 0;
+                variation += !comment && c == '(' ? 1 : !comment && c == ')' ? -1 : 0;
+            }
+            if (comment || variation || token.back() == '}' || token.back() == ')' || token[0] == '$')
+                continue;
+            if (token[0] == ';')
+                break;
+            if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*")
+            {
+                game.result = token == "1-0" ? 1 : token == "0-1" ? -1 : token == "*" ? 2 : 0;
+                continue;
+            }
+            size_t dot = token.find_last_of('.');
+            if (dot != string::npos)
+                token = token.substr(dot + 1);
+            if (!token.empty() && !isdigit(token[0]))
+                game.moves.push_back(token);
+        }
+    }
+}
+
+// A bounded multi-producer, multi-consumer queue: push blocks while it is
+// full and pop returns false once it is closed and drained.
+template <typename T>
+class BoundedQueue
+{
+private:
+    deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    mutex lock;
+    condition_variable notEmpty, notFull;
+
+public:
+    explicit BoundedQueue(size_t limit) : capacity(limit) {}
+
+    void push(T item)
+    {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [&] { return items.size() < capacity; });
+        items.push_back(move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T &item)
+    {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [&] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+struct PgnBatch
+{
+    uint64_t firstGame = 0; // 1-based number of games[0] in the file.
+    vector<string> games;
+};
+
+// "pgn check <file|-> [threads]" validates every game and prints the errors;
+// "pgn fens <file|-> [threads]" also prints the FEN of each position reached.
+int runPgnPipeline(const string &mode, const string &path, int threadCount)
+{
+    if (mode != "check" && mode != "fens")
+    {
+        cout << "Unknown PGN mode " << mode << " (check or fens)" << endl;
+        return 1;
+    }
+    PgnReader reader;
+    if (!reader.open(path))
+    {
+        cout << "Cannot open " << path << endl;
+        return 1;
+    }
+    const size_t batchSize = 64;
+    threadCount = max(threadCount, 1);
+    BoundedQueue<PgnBatch> queue(threadCount * 4);
+    atomic<uint64_t> positions{ 0 }, errors{ 0 };
+    bool printFens = mode == "fens";
+
+    auto worker = [&] {
+        PgnBatch batch;
+        PgnGame game;
+        ChessBoard board;
+        string out;
+        while (queue.pop(batch))
+        {
+            uint64_t batchPositions = 0, batchErrors = 0;
+            out.clear();
+            for (size_t i = 0; i < batch.games.size(); i++)
+            {
+                string where = "game " + to_string(batch.firstGame + i);
+                parsePgnGame(batch.games[i], game);
+                if (!board.loadFen(game.fen))
+                {
+                    out += where + ": invalid FEN " + game.fen + "\n";
+                    batchErrors++;
+                    continue;
+                }
+                batchPositions++;
+                if (printFens)
+                    out += board.toFen() + "\n";
+                for (size_t ply = 0; ply < game.moves.size(); ply++)
+                {
+                    Move move = parseSan(board, game.moves[ply]);
+                    if (move == Move::none())
+                    {
+                        out += where + " ply " + to_string(ply + 1) + ": illegal move " + game.moves[ply] + "\n";
+                        batchErrors++;
+                        break;
+                    }
+                    board.applyMove(move);
+                    batchPositions++;
+                    if (printFens)
+                        out += board.toFen() + "\n";
+                }
+            }
+            positions += batchPositions;
+            errors += batchErrors;
+            if (!out.empty())
+            {
+                lock_guard<mutex> guard(outputLock);
+                cout << out;
+            }
+        }
+        telemetryFlush();
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int i = 0; i < threadCount; i++)
+        workers.emplace_back(worker);
+    uint64_t games = 0;
+    PgnBatch batch;
+    batch.firstGame = 1;
+    string text;
+    while (reader.next(text))
+    {
+        batch.games.push_back(move(text));
+        if (++games % batchSize == 0)
+        {
+            queue.push(move(batch));
+            batch = PgnBatch();
+            batch.firstGame = games + 1;
+        }
+    }
+    if (!batch.games.empty())
+        queue.push(move(batch));
+    queue.close();
+    for (auto &thread : workers)
+        thread.join();
+
+    double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+    // Statistics go to stderr when the positions themselves fill stdout.
+    ostream &report = printFens ? cerr : cout;
+    report << "Games " << games << " (" << errors << " with errors), positions " << positions << " in " << fixed
+           << setprecision(3) << seconds << " s: " << (uint64_t)(games / seconds) << " games/s, "
+           << (uint64_t)(positions / seconds) << " positions/s, " << setprecision(1)
+           << reader.bytes / seconds / (1 << 20) << " MB/s" << endl;
+    if (telemetryEnabled)
+        report << telemetrySnapshot().toJson() << endl;
+    return errors ? 1 : 0;
+}
+
+// --- Opening Book ---
+// Polyglot books: 16-byte big-endian entries (key, move, weight, learn) sorted
+// by key. The file is memory-mapped and searched in place, so opening a book
+// costs nothing and a lookup touches a few pages.
+//
+// The keys come from the standard Polyglot Random64 table (public domain):
+// 768 piece-square numbers, 4 for the castling rights, 8 for the en passant
+// file and one for White to move. "book test" checks it against the keys
+// published with the format.
+
+const uint64_t polyglotRandom[781] = {
+    0x9D39247E33776D41ULL, 0x2AF7398005AAA5C7ULL, 0x44DB015024623547ULL, 0x9C15F73E62A76AE2ULL,
+    0x75834465489C0C89ULL, 0x3290AC3A203001BFULL, 0x0FBBAD1F61042279ULL, 0xE83A908FF2FB60CAULL,
+    0x0D7E765D58755C10ULL, 0x1A083822CEAFE02DULL, 0x9605D5F0E25EC3B0ULL, 0xD021FF5CD13A2ED5ULL,
+    0x40BDF15D4A672E32ULL, 0x011355146FD56395ULL, 0x5DB4832046F3D9E5ULL, 0x239F8B2D7FF719CCULL,
+    0x05D1A1AE85B49AA1ULL, 0x679F848F6E8FC971ULL, 0x7449BBFF801FED0BULL, 0x7D11CDB1C3B7ADF0ULL,
+    0x82C7709E781EB7CCULL, 0xF3218F1C9510786CULL, 0x331478F3AF51BBE6ULL, 0x4BB38DE5E7219443ULL,
+    0xAA649C6EBCFD50FCULL, 0x8DBD98A352AFD40BULL, 0x87D2074B81D79217ULL, 0x19F3C751D3E92AE1ULL,
+    0xB4AB30F062B19ABFULL, 0x7B0500AC42047AC4ULL, 0xC9452CA81A09D85DULL, 0x24AA6C514DA27500ULL,
+    0x4C9F34427501B447ULL, 0x14A68FD73C910841ULL, 0xA71B9B83461CBD93ULL, 0x03488B95B0F1850FULL,
+    0x637B2B34FF93C040ULL, 0x09D1BC9A3DD90A94ULL, 0x3575668334A1DD3BULL, 0x735E2B97A4C45A23ULL,
+    0x18727070F1BD400BULL, 0x1FCBACD259BF02E7ULL, 0xD310A7C2CE9B6555ULL, 0xBF983FE0FE5D8244ULL,
+    0x9F74D14F7454A824ULL, 0x51EBDC4AB9BA3035ULL, 0x5C82C505DB9AB0FAULL, 0xFCF7FE8A3430B241ULL,
+    0x3253A729B9BA3DDEULL, 0x8C74C368081B3075ULL, 0xB9BC6C87167C33E7ULL, 0x7EF48F2B83024E20ULL,
+    0x11D505D4C351BD7FULL, 0x6568FCA92C76A243ULL, 0x4DE0B0F40F32A7B8ULL, 0x96D693460CC37E5DULL,
+    0x42E240CB63689F2FULL, 0x6D2BDCDAE2919661ULL, 0x42880B0236E4D951ULL, 0x5F0F4A5898171BB6ULL,
+    0x39F890F579F92F88ULL, 0x93C5B5F47356388BULL, 0x63DC359D8D231B78ULL, 0xEC16CA8AEA98AD76ULL,
+    0x5355F900C2A82DC7ULL, 0x07FB9F855A997142ULL, 0x5093417AA8A7ED5EULL, 0x7BCBC38DA25A7F3CULL,
+    0x19FC8A768CF4B6D4ULL, 0x637A7780DECFC0D9ULL, 0x8249A47AEE0E41F7ULL, 0x79AD695501E7D1E8ULL,
+    0x14ACBAF4777D5776ULL, 0xF145B6BECCDEA195ULL, 0xDABF2AC8201752FCULL, 0x24C3C94DF9C8D3F6ULL,
+    0xBB6E2924F03912EAULL, 0x0CE26C0B95C980D9ULL, 0xA49CD132BFBF7CC4ULL, 0xE99D662AF4243939ULL,
+    0x27E6AD7891165C3FULL, 0x8535F040B9744FF1ULL, 0x54B3F4FA5F40D873ULL, 0x72B12C32127FED2BULL,
+    0xEE954D3C7B411F47ULL, 0x9A85AC909A24EAA1ULL, 0x70AC4CD9F04F21F5ULL, 0xF9B89D3E99A075C2ULL,
+    0x87B3E2B2B5C907B1ULL, 0xA366E5B8C54F48B8ULL, 0xAE4A9346CC3F7CF2ULL, 0x1920C04D47267BBDULL,
+    0x87BF02C6B49E2AE9ULL, 0x092237AC237F3859ULL, 0xFF07F64EF8ED14D0ULL, 0x8DE8DCA9F03CC54EULL,
+    0x9C1633264DB49C89ULL, 0xB3F22C3D0B0B38EDULL, 0x390E5FB44D01144BULL, 0x5BFEA5B4712768E9ULL,
+    0x1E1032911FA78984ULL, 0x9A74ACB964E78CB3ULL, 0x4F80F7A035DAFB04ULL, 0x6304D09A0B3738C4ULL,
+    0x2171E64683023A08ULL, 0x5B9B63EB9CEFF80CULL, 0x506AACF489889342ULL, 0x1881AFC9A3A701D6ULL,
+    0x6503080440750644ULL, 0xDFD395339CDBF4A7ULL, 0xEF927DBCF00C20F2ULL, 0x7B32F7D1E03680ECULL,
+    0xB9FD7620E7316243ULL, 0x05A7E8A57DB91B77ULL, 0xB5889C6E15630A75ULL, 0x4A750A09CE9573F7ULL,
+    0xCF464CEC899A2F8AULL, 0xF538639CE705B824ULL, 0x3C79A0FF5580EF7FULL, 0xEDE6C87F8477609DULL,
+    0x799E81F05BC93F31ULL, 0x86536B8CF3428A8CULL, 0x97D7374C60087B73ULL, 0xA246637CFF328532ULL,
+    0x043FCAE60CC0EBA0ULL, 0x920E449535DD359EULL, 0x70EB093B15B290CCULL, 0x73A1921916591CBDULL,
+    0x56436C9FE1A1AA8DULL, 0xEFAC4B70633B8F81ULL, 0xBB215798D45DF7AFULL, 0x45F20042F24F1768ULL,
+    0x930F80F4E8EB7462ULL, 0xFF6712FFCFD75EA1ULL, 0xAE623FD67468AA70ULL, 0xDD2C5BC84BC8D8FCULL,
+    0x7EED120D54CF2DD9ULL, 0x22FE545401165F1CULL, 0xC91800E98FB99929ULL, 0x808BD68E6AC10365ULL,
+    0xDEC468145B7605F6ULL, 0x1BEDE3A3AEF53302ULL, 0x43539603D6C55602ULL, 0xAA969B5C691CCB7AULL,
+    0xA87832D392EFEE56ULL, 0x65942C7B3C7E11AEULL, 0xDED2D633CAD004F6ULL, 0x21F08570F420E565ULL,
+    0xB415938D7DA94E3CULL, 0x91B859E59ECB6350ULL, 0x10CFF333E0ED804AULL, 0x28AED140BE0BB7DDULL,
+    0xC5CC1D89724FA456ULL, 0x5648F680F11A2741ULL, 0x2D255069F0B7DAB3ULL, 0x9BC5A38EF729ABD4ULL,
+    0xEF2F054308F6A2BCULL, 0xAF2042F5CC5C2858ULL, 0x480412BAB7F5BE2AULL, 0xAEF3AF4A563DFE43ULL,
+    0x19AFE59AE451497FULL, 0x52593803DFF1E840ULL, 0xF4F076E65F2CE6F0ULL, 0x11379625747D5AF3ULL,
+    0xBCE5D2248682C115ULL, 0x9DA4243DE836994FULL, 0x066F70B33FE09017ULL, 0x4DC4DE189B671A1CULL,
+    0x51039AB7712457C3ULL, 0xC07A3F80C31FB4B4ULL, 0xB46EE9C5E64A6E7CULL, 0xB3819A42ABE61C87ULL,
+    0x21A007933A522A20ULL, 0x2DF16F761598AA4FULL, 0x763C4A1371B368FDULL, 0xF793C46702E086A0ULL,
+    0xD7288E012AEB8D31ULL, 0xDE336A2A4BC1C44BULL, 0x0BF692B38D079F23ULL, 0x2C604A7A177326B3ULL,
+    0x4850E73E03EB6064ULL, 0xCFC447F1E53C8E1BULL, 0xB05CA3F564268D99ULL, 0x9AE182C8BC9474E8ULL,
+    0xA4FC4BD4FC5558CAULL, 0xE755178D58FC4E76ULL, 0x69B97DB1A4C03DFEULL, 0xF9B5B7C4ACC67C96ULL,
+    0xFC6A82D64B8655FBULL, 0x9C684CB6C4D24417ULL, 0x8EC97D2917456ED0ULL, 0x6703DF9D2924E97EULL,
+    0xC547F57E42A7444EULL, 0x78E37644E7CAD29EULL, 0xFE9A44E9362F05FAULL, 0x08BD35CC38336615ULL,
+    0x9315E5EB3A129ACEULL, 0x94061B871E04DF75ULL, 0xDF1D9F9D784BA010ULL, 0x3BBA57B68871B59DULL,
+    0xD2B7ADEEDED1F73FULL, 0xF7A255D83BC373F8ULL, 0xD7F4F2448C0CEB81ULL, 0xD95BE88CD210FFA7ULL,
+    0x336F52F8FF4728E7ULL, 0xA74049DAC312AC71ULL, 0xA2F61BB6E437FDB5ULL, 0x4F2A5CB07F6A35B3ULL,
+    0x87D380BDA5BF7859ULL, 0x16B9F7E06C453A21ULL, 0x7BA2484C8A0FD54EULL, 0xF3A678CAD9A2E38CULL,
+    0x39B0BF7DDE437BA2ULL, 0xFCAF55C1BF8A4424ULL, 0x18FCF680573FA594ULL, 0x4C0563B89F495AC3ULL,
+    0x40E087931A00930DULL, 0x8CFFA9412EB642C1ULL, 0x68CA39053261169FULL, 0x7A1EE967D27579E2ULL,
+    0x9D1D60E5076F5B6FULL, 0x3810E399B6F65BA2ULL, 0x32095B6D4AB5F9B1ULL, 0x35CAB62109DD038AULL,
+    0xA90B24499FCFAFB1ULL, 0x77A225A07CC2C6BDULL, 0x513E5E634C70E331ULL, 0x4361C0CA3F692F12ULL,
+    0xD941ACA44B20A45BULL, 0x528F7C8602C5807BULL, 0x52AB92BEB9613989ULL, 0x9D1DFA2EFC557F73ULL,
+    0x722FF175F572C348ULL, 0x1D1260A51107FE97ULL, 0x7A249A57EC0C9BA2ULL, 0x04208FE9E8F7F2D6ULL,
+    0x5A110C6058B920A0ULL, 0x0CD9A497658A5698ULL, 0x56FD23C8F9715A4CULL, 0x284C847B9D887AAEULL,
+    0x04FEABFBBDB619CBULL, 0x742E1E651C60BA83ULL, 0x9A9632E65904AD3CULL, 0x881B82A13B51B9E2ULL,
+    0x506E6744CD974924ULL, 0xB0183DB56FFC6A79ULL, 0x0ED9B915C66ED37EULL, 0x5E11E86D5873D484ULL,
+    0xF678647E3519AC6EULL, 0x1B85D488D0F20CC5ULL, 0xDAB9FE6525D89021ULL, 0x0D151D86ADB73615ULL,
+    0xA865A54EDCC0F019ULL, 0x93C42566AEF98FFBULL, 0x99E7AFEABE000731ULL, 0x48CBFF086DDF285AULL,
+    0x7F9B6AF1EBF78BAFULL, 0x58627E1A149BBA21ULL, 0x2CD16E2ABD791E33ULL, 0xD363EFF5F0977996ULL,
+    0x0CE2A38C344A6EEDULL, 0x1A804AADB9CFA741ULL, 0x907F30421D78C5DEULL, 0x501F65EDB3034D07ULL,
+    0x37624AE5A48FA6E9ULL, 0x957BAF61700CFF4EULL, 0x3A6C27934E31188AULL, 0xD49503536ABCA345ULL,
+    0x088E049589C432E0ULL, 0xF943AEE7FEBF21B8ULL, 0x6C3B8E3E336139D3ULL, 0x364F6FFA464EE52EULL,
+    0xD60F6DCEDC314222ULL, 0x56963B0DCA418FC0ULL, 0x16F50EDF91E513AFULL, 0xEF1955914B609F93ULL,
+    0x565601C0364E3228ULL, 0xECB53939887E8175ULL, 0xBAC7A9A18531294BULL, 0xB344C470397BBA52ULL,
+    0x65D34954DAF3CEBDULL, 0xB4B81B3FA97511E2ULL, 0xB422061193D6F6A7ULL, 0x071582401C38434DULL,
+    0x7A13F18BBEDC4FF5ULL, 0xBC4097B116C524D2ULL, 0x59B97885E2F2EA28ULL, 0x99170A5DC3115544ULL,
+    0x6F423357E7C6A9F9ULL, 0x325928EE6E6F8794ULL, 0xD0E4366228B03343ULL, 0x565C31F7DE89EA27ULL,
+    0x30F5611484119414ULL, 0xD873DB391292ED4FULL, 0x7BD94E1D8E17DEBCULL, 0xC7D9F16864A76E94ULL,
+    0x947AE053EE56E63CULL, 0xC8C93882F9475F5FULL, 0x3A9BF55BA91F81CAULL, 0xD9A11FBB3D9808E4ULL,
+    0x0FD22063EDC29FCAULL, 0xB3F256D8ACA0B0B9ULL, 0xB03031A8B4516E84ULL, 0x35DD37D5871448AFULL,
+    0xE9F6082B05542E4EULL, 0xEBFAFA33D7254B59ULL, 0x9255ABB50D532280ULL, 0xB9AB4CE57F2D34F3ULL,
+    0x693501D628297551ULL, 0xC62C58F97DD949BFULL, 0xCD454F8F19C5126AULL, 0xBBE83F4ECC2BDECBULL,
+    0xDC842B7E2819E230ULL, 0xBA89142E007503B8ULL, 0xA3BC941D0A5061CBULL, 0xE9F6760E32CD8021ULL,
+    0x09C7E552BC76492FULL, 0x852F54934DA55CC9ULL, 0x8107FCCF064FCF56ULL, 0x098954D51FFF6580ULL,
+    0x23B70EDB1955C4BFULL, 0xC330DE426430F69DULL, 0x4715ED43E8A45C0AULL, 0xA8D7E4DAB780A08DULL,
+    0x0572B974F03CE0BBULL, 0xB57D2E985E1419C7ULL, 0xE8D9ECBE2CF3D73FULL, 0x2FE4B17170E59750ULL,
+    0x11317BA87905E790ULL, 0x7FBF21EC8A1F45ECULL, 0x1725CABFCB045B00ULL, 0x964E915CD5E2B207ULL,
+    0x3E2B8BCBF016D66DULL, 0xBE7444E39328A0ACULL, 0xF85B2B4FBCDE44B7ULL, 0x49353FEA39BA63B1ULL,
+    0x1DD01AAFCD53486AULL, 0x1FCA8A92FD719F85ULL, 0xFC7C95D827357AFAULL, 0x18A6A990C8B35EBDULL,
+    0xCCCB7005C6B9C28DULL, 0x3BDBB92C43B17F26ULL, 0xAA70B5B4F89695A2ULL, 0xE94C39A54A98307FULL,
+    0xB7A0B174CFF6F36EULL, 0xD4DBA84729AF48ADULL, 0x2E18BC1AD9704A68ULL, 0x2DE0966DAF2F8B1CULL,
+    0xB9C11D5B1E43A07EULL, 0x64972D68DEE33360ULL, 0x94628D38D0C20584ULL, 0xDBC0D2B6AB90A559ULL,
+    0xD2733C4335C6A72FULL, 0x7E75D99D94A70F4DULL, 0x6CED1983376FA72BULL, 0x97FCAACBF030BC24ULL,
+    0x7B77497B32503B12ULL, 0x8547EDDFB81CCB94ULL, 0x79999CDFF70902CBULL, 0xCFFE1939438E9B24ULL,
+    0x829626E3892D95D7ULL, 0x92FAE24291F2B3F1ULL, 0x63E22C147B9C3403ULL, 0xC678B6D860284A1CULL,
+    0x5873888850659AE7ULL, 0x0981DCD296A8736DULL, 0x9F65789A6509A440ULL, 0x9FF38FED72E9052FULL,
+    0xE479EE5B9930578CULL, 0xE7F28ECD2D49EECDULL, 0x56C074A581EA17FEULL, 0x5544F7D774B14AEFULL,
+    0x7B3F0195FC6F290FULL, 0x12153635B2C0CF57ULL, 0x7F5126DBBA5E0CA7ULL, 0x7A76956C3EAFB413ULL,
+    0x3D5774A11D31AB39ULL, 0x8A1B083821F40CB4ULL, 0x7B4A38E32537DF62ULL, 0x950113646D1D6E03ULL,
+    0x4DA8979A0041E8A9ULL, 0x3BC36E078F7515D7ULL, 0x5D0A12F27AD310D1ULL, 0x7F9D1A2E1EBE1327ULL,
+    0xDA3A361B1C5157B1ULL, 0xDCDD7D20903D0C25ULL, 0x36833336D068F707ULL, 0xCE68341F79893389ULL,
+    0xAB9090168DD05F34ULL, 0x43954B3252DC25E5ULL, 0xB438C2B67F98E5E9ULL, 0x10DCD78E3851A492ULL,
+    0xDBC27AB5447822BFULL, 0x9B3CDB65F82CA382ULL, 0xB67B7896167B4C84ULL, 0xBFCED1B0048EAC50ULL,
+    0xA9119B60369FFEBDULL, 0x1FFF7AC80904BF45ULL, 0xAC12FB171817EEE7ULL, 0xAF08DA9177DDA93DULL,
+    0x1B0CAB936E65C744ULL, 0xB559EB1D04E5E932ULL, 0xC37B45B3F8D6F2BAULL, 0xC3A9DC228CAAC9E9ULL,
+    0xF3B8B6675A6507FFULL, 0x9FC477DE4ED681DAULL, 0x67378D8ECCEF96CBULL, 0x6DD856D94D259236ULL,
+    0xA319CE15B0B4DB31ULL, 0x073973751F12DD5EULL, 0x8A8E849EB32781A5ULL, 0xE1925C71285279F5ULL,
+    0x74C04BF1790C0EFEULL, 0x4DDA48153C94938AULL, 0x9D266D6A1CC0542CULL, 0x7440FB816508C4FEULL,
+    0x13328503DF48229FULL, 0xD6BF7BAEE43CAC40ULL, 0x4838D65F6EF6748FULL, 0x1E152328F3318DEAULL,
+    0x8F8419A348F296BFULL, 0x72C8834A5957B511ULL, 0xD7A023A73260B45CULL, 0x94EBC8ABCFB56DAEULL,
+    0x9FC10D0F989993E0ULL, 0xDE68A2355B93CAE6ULL, 0xA44CFE79AE538BBEULL, 0x9D1D84FCCE371425ULL,
+    0x51D2B1AB2DDFB636ULL, 0x2FD7E4B9E72CD38CULL, 0x65CA5B96B7552210ULL, 0xDD69A0D8AB3B546DULL,
+    0x604D51B25FBF70E2ULL, 0x73AA8A564FB7AC9EULL, 0x1A8C1E992B941148ULL, 0xAAC40A2703D9BEA0ULL,
+    0x764DBEAE7FA4F3A6ULL, 0x1E99B96E70A9BE8BULL, 0x2C5E9DEB57EF4743ULL, 0x3A938FEE32D29981ULL,
+    0x26E6DB8FFDF5ADFEULL, 0x469356C504EC9F9DULL, 0xC8763C5B08D1908CULL, 0x3F6C6AF859D80055ULL,
+    0x7F7CC39420A3A545ULL, 0x9BFB227EBDF4C5CEULL, 0x89039D79D6FC5C5CULL, 0x8FE88B57305E2AB6ULL,
+    0xA09E8C8C35AB96DEULL, 0xFA7E393983325753ULL, 0xD6B6D0ECC617C699ULL, 0xDFEA21EA9E7557E3ULL,
+    0xB67C1FA481680AF8ULL, 0xCA1E3785A9E724E5ULL, 0x1CFC8BED0D681639ULL, 0xD18D8549D140CAEAULL,
+    0x4ED0FE7E9DC91335ULL, 0xE4DBF0634473F5D2ULL, 0x1761F93A44D5AEFEULL, 0x53898E4C3910DA55ULL,
+    0x734DE8181F6EC39AULL, 0x2680B122BAA28D97ULL, 0x298AF231C85BAFABULL, 0x7983EED3740847D5ULL,
+    0x66C1A2A1A60CD889ULL, 0x9E17E49642A3E4C1ULL, 0xEDB454E7BADC0805ULL, 0x50B704CAB602C329ULL,
+    0x4CC317FB9CDDD023ULL, 0x66B4835D9EAFEA22ULL, 0x219B97E26FFC81BDULL, 0x261E4E4C0A333A9DULL,
+    0x1FE2CCA76517DB90ULL, 0xD7504DFA8816EDBBULL, 0xB9571FA04DC089C8ULL, 0x1DDC0325259B27DEULL,
+    0xCF3F4688801EB9AAULL, 0xF4F5D05C10CAB243ULL, 0x38B6525C21A42B0EULL, 0x36F60E2BA4FA6800ULL,
+    0xEB3593803173E0CEULL, 0x9C4CD6257C5A3603ULL, 0xAF0C317D32ADAA8AULL, 0x258E5A80C7204C4BULL,
+    0x8B889D624D44885DULL, 0xF4D14597E660F855ULL, 0xD4347F66EC8941C3ULL, 0xE699ED85B0DFB40DULL,
+    0x2472F6207C2D0484ULL, 0xC2A1E7B5B459AEB5ULL, 0xAB4F6451CC1D45ECULL, 0x63767572AE3D6174ULL,
+    0xA59E0BD101731A28ULL, 0x116D0016CB948F09ULL, 0x2CF9C8CA052F6E9FULL, 0x0B090A7560A968E3ULL,
+    0xABEEDDB2DDE06FF1ULL, 0x58EFC10B06A2068DULL, 0xC6E57A78FBD986E0ULL, 0x2EAB8CA63CE802D7ULL,
+    0x14A195640116F336ULL, 0x7C0828DD624EC390ULL, 0xD74BBE77E6116AC7ULL, 0x804456AF10F5FB53ULL,
+    0xEBE9EA2ADF4321C7ULL, 0x03219A39EE587A30ULL, 0x49787FEF17AF9924ULL, 0xA1E9300CD8520548ULL,
+    0x5B45E522E4B1B4EFULL, 0xB49C3B3995091A36ULL, 0xD4490AD526F14431ULL, 0x12A8F216AF9418C2ULL,
+    0x001F837CC7350524ULL, 0x1877B51E57A764D5ULL, 0xA2853B80F17F58EEULL, 0x993E1DE72D36D310ULL,
+    0xB3598080CE64A656ULL, 0x252F59CF0D9F04BBULL, 0xD23C8E176D113600ULL, 0x1BDA0492E7E4586EULL,
+    0x21E0BD5026C619BFULL, 0x3B097ADAF088F94EULL, 0x8D14DEDB30BE846EULL, 0xF95CFFA23AF5F6F4ULL,
+    0x3871700761B3F743ULL, 0xCA672B91E9E4FA16ULL, 0x64C8E531BFF53B55ULL, 0x241260ED4AD1E87DULL,
+    0x106C09B972D2E822ULL, 0x7FBA195410E5CA30ULL, 0x7884D9BC6CB569D8ULL, 0x0647DFEDCD894A29ULL,
+    0x63573FF03E224774ULL, 0x4FC8E9560F91B123ULL, 0x1DB956E450275779ULL, 0xB8D91274B9E9D4FBULL,
+    0xA2EBEE47E2FBFCE1ULL, 0xD9F1F30CCD97FB09ULL, 0xEFED53D75FD64E6BULL, 0x2E6D02C36017F67FULL,
+    0xA9AA4D20DB084E9BULL, 0xB64BE8D8B25396C1ULL, 0x70CB6AF7C2D5BCF0ULL, 0x98F076A4F7A2322EULL,
+    0xBF84470805E69B5FULL, 0x94C3251F06F90CF3ULL, 0x3E003E616A6591E9ULL, 0xB925A6CD0421AFF3ULL,
+    0x61BDD1307C66E300ULL, 0xBF8D5108E27E0D48ULL, 0x240AB57A8B888B20ULL, 0xFC87614BAF287E07ULL,
+    0xEF02CDD06FFDB432ULL, 0xA1082C0466DF6C0AULL, 0x8215E577001332C8ULL, 0xD39BB9C3A48DB6CFULL,
+    0x2738259634305C14ULL, 0x61CF4F94C97DF93DULL, 0x1B6BACA2AE4E125BULL, 0x758F450C88572E0BULL,
+    0x959F587D507A8359ULL, 0xB063E962E045F54DULL, 0x60E8ED72C0DFF5D1ULL, 0x7B64978555326F9FULL,
+    0xFD080D236DA814BAULL, 0x8C90FD9B083F4558ULL, 0x106F72FE81E2C590ULL, 0x7976033A39F7D952ULL,
+    0xA4EC0132764CA04BULL, 0x733EA705FAE4FA77ULL, 0xB4D8F77BC3E56167ULL, 0x9E21F4F903B33FD9ULL,
+    0x9D765E419FB69F6DULL, 0xD30C088BA61EA5EFULL, 0x5D94337FBFAF7F5BULL, 0x1A4E4822EB4D7A59ULL,
+    0x6FFE73E81B637FB3ULL, 0xDDF957BC36D8B9CAULL, 0x64D0E29EEA8838B3ULL, 0x08DD9BDFD96B9F63ULL,
+    0x087E79E5A57D1D13ULL, 0xE328E230E3E2B3FBULL, 0x1C2559E30F0946BEULL, 0x720BF5F26F4D2EAAULL,
+    0xB0774D261CC609DBULL, 0x443F64EC5A371195ULL, 0x4112CF68649A260EULL, 0xD813F2FAB7F5C5CAULL,
+    0x660D3257380841EEULL, 0x59AC2C7873F910A3ULL, 0xE846963877671A17ULL, 0x93B633ABFA3469F8ULL,
+    0xC0C0F5A60EF4CDCFULL, 0xCAF21ECD4377B28CULL, 0x57277707199B8175ULL, 0x506C11B9D90E8B1DULL,
+    0xD83CC2687A19255FULL, 0x4A29C6465A314CD1ULL, 0xED2DF21216235097ULL, 0xB5635C95FF7296E2ULL,
+    0x22AF003AB672E811ULL, 0x52E762596BF68235ULL, 0x9AEBA33AC6ECC6B0ULL, 0x944F6DE09134DFB6ULL,
+    0x6C47BEC883A7DE39ULL, 0x6AD047C430A12104ULL, 0xA5B1CFDBA0AB4067ULL, 0x7C45D833AFF07862ULL,
+    0x5092EF950A16DA0BULL, 0x9338E69C052B8E7BULL, 0x455A4B4CFE30E3F5ULL, 0x6B02E63195AD0CF8ULL,
+    0x6B17B224BAD6BF27ULL, 0xD1E0CCD25BB9C169ULL, 0xDE0C89A556B9AE70ULL, 0x50065E535A213CF6ULL,
+    0x9C1169FA2777B874ULL, 0x78EDEFD694AF1EEDULL, 0x6DC93D9526A50E68ULL, 0xEE97F453F06791EDULL,
+    0x32AB0EDB696703D3ULL, 0x3A6853C7E70757A7ULL, 0x31865CED6120F37DULL, 0x67FEF95D92607890ULL,
+    0x1F2B1D1F15F6DC9CULL, 0xB69E38A8965C6B65ULL, 0xAA9119FF184CCCF4ULL, 0xF43C732873F24C13ULL,
+    0xFB4A3D794A9A80D2ULL, 0x3550C2321FD6109CULL, 0x371F77E76BB8417EULL, 0x6BFA9AAE5EC05779ULL,
+    0xCD04F3FF001A4778ULL, 0xE3273522064480CAULL, 0x9F91508BFFCFC14AULL, 0x049A7F41061A9E60ULL,
+    0xFCB6BE43A9F2FE9BULL, 0x08DE8A1C7797DA9BULL, 0x8F9887E6078735A1ULL, 0xB5B4071DBFC73A66ULL,
+    0x230E343DFBA08D33ULL, 0x43ED7F5A0FAE657DULL, 0x3A88A0FBBCB05C63ULL, 0x21874B8B4D2DBC4FULL,
+    0x1BDEA12E35F6A8C9ULL, 0x53C065C6C8E63528ULL, 0xE34A1D250E7A8D6BULL, 0xD6B04D3B7651DD7EULL,
+    0x5E90277E7CB39E2DULL, 0x2C046F22062DC67DULL, 0xB10BB459132D0A26ULL, 0x3FA9DDFB67E2F199ULL,
+    0x0E09B88E1914F7AFULL, 0x10E8B35AF3EEAB37ULL, 0x9EEDECA8E272B933ULL, 0xD4C718BC4AE8AE5FULL,
+    0x81536D601170FC20ULL, 0x91B534F885818A06ULL, 0xEC8177F83F900978ULL, 0x190E714FADA5156EULL,
+    0xB592BF39B0364963ULL, 0x89C350C893AE7DC1ULL, 0xAC042E70F8B383F2ULL, 0xB49B52E587A1EE60ULL,
+    0xFB152FE3FF26DA89ULL, 0x3E666E6F69AE2C15ULL, 0x3B544EBE544C19F9ULL, 0xE805A1E290CF2456ULL,
+    0x24B33C9D7ED25117ULL, 0xE74733427B72F0C1ULL, 0x0A804D18B7097475ULL, 0x57E3306D881EDB4FULL,
+    0x4AE7D6A36EB5DBCBULL, 0x2D8D5432157064C8ULL, 0xD1E649DE1E7F268BULL, 0x8A328A1CEDFE552CULL,
+    0x07A3AEC79624C7DAULL, 0x84547DDC3E203C94ULL, 0x990A98FD5071D263ULL, 0x1A4FF12616EEFC89ULL,
+    0xF6F7FD1431714200ULL, 0x30C05B1BA332F41CULL, 0x8D2636B81555A786ULL, 0x46C9FEB55D120902ULL,
+    0xCCEC0A73B49C9921ULL, 0x4E9D2827355FC492ULL, 0x19EBB029435DCB0FULL, 0x4659D2B743848A2CULL,
+    0x963EF2C96B33BE31ULL, 0x74F85198B05A2E7DULL, 0x5A0F544DD2B1FB18ULL, 0x03727073C2E134B1ULL,
+    0xC7F6AA2DE59AEA61ULL, 0x352787BAA0D7C22FULL, 0x9853EAB63B5E0B35ULL, 0xABBDCDD7ED5C0860ULL,
+    0xCF05DAF5AC8D77B0ULL, 0x49CAD48CEBF4A71EULL, 0x7A4C10EC2158C4A6ULL, 0xD9E92AA246BF719EULL,
+    0x13AE978D09FE5557ULL, 0x730499AF921549FFULL, 0x4E4B705B92903BA4ULL, 0xFF577222C14F0A3AULL,
+    0x55B6344CF97AAFAEULL, 0xB862225B055B6960ULL, 0xCAC09AFBDDD2CDB4ULL, 0xDAF8E9829FE96B5FULL,
+    0xB5FDFC5D3132C498ULL, 0x310CB380DB6F7503ULL, 0xE87FBB46217A360EULL, 0x2102AE466EBB1148ULL,
+    0xF8549E1A3AA5E00DULL, 0x07A69AFDCC42261AULL, 0xC4C118BFE78FEAAEULL, 0xF9F4892ED96BD438ULL,
+    0x1AF3DBE25D8F45DAULL, 0xF5B4B0B0D2DEEEB4ULL, 0x962ACEEFA82E1C84ULL, 0x046E3ECAAF453CE9ULL,
+    0xF05D129681949A4CULL, 0x964781CE734B3C84ULL, 0x9C2ED44081CE5FBDULL, 0x522E23F3925E319EULL,
+    0x177E00F9FC32F791ULL, 0x2BC60A63A6F3B3F2ULL, 0x222BBFAE61725606ULL, 0x486289DDCC3D6780ULL,
+    0x7DC7785B8EFDFC80ULL, 0x8AF38731C02BA980ULL, 0x1FAB64EA29A2DDF7ULL, 0xE4D9429322CD065AULL,
+    0x9DA058C67844F20CULL, 0x24C0E332B70019B0ULL, 0x233003B5A6CFE6ADULL, 0xD586BD01C5C217F6ULL,
+    0x5E5637885F29BC2BULL, 0x7EBA726D8C94094BULL, 0x0A56A5F0BFE39272ULL, 0xD79476A84EE20D06ULL,
+    0x9E4C1269BAA4BF37ULL, 0x17EFEE45B0DEE640ULL, 0x1D95B0A5FCF90BC6ULL, 0x93CBE0B699C2585DULL,
+    0x65FA4F227A2B6D79ULL, 0xD5F9E858292504D5ULL, 0xC2B5A03F71471A6FULL, 0x59300222B4561E00ULL,
+    0xCE2F8642CA0712DCULL, 0x7CA9723FBB2E8988ULL, 0x2785338347F2BA08ULL, 0xC61BB3A141E50E8CULL,
+    0x150F361DAB9DEC26ULL, 0x9F6A419D382595F4ULL, 0x64A53DC924FE7AC9ULL, 0x142DE49FFF7A7C3DULL,
+    0x0C335248857FA9E7ULL, 0x0A9C32D5EAE45305ULL, 0xE6C42178C4BBB92EULL, 0x71F1CE2490D20B07ULL,
+    0xF1BCC3D275AFE51AULL, 0xE728E8C83C334074ULL, 0x96FBF83A12884624ULL, 0x81A1549FD6573DA5ULL,
+    0x5FA7867CAF35E149ULL, 0x56986E2EF3ED091BULL, 0x917F1DD5F8886C61ULL, 0xD20D8C88C8FFE65FULL,
+    0x31D71DCE64B2C310ULL, 0xF165B587DF898190ULL, 0xA57E6339DD2CF3A0ULL, 0x1EF6E6DBB1961EC9ULL,
+    0x70CC73D90BC26E24ULL, 0xE21A6B35DF0C3AD7ULL, 0x003A93D8B2806962ULL, 0x1C99DED33CB890A1ULL,
+    0xCF3145DE0ADD4289ULL, 0xD0E4427A5514FB72ULL, 0x77C621CC9FB3A483ULL, 0x67A34DAC4356550BULL,
+    0xF8D626AAAF278509ULL
+};
+
+uint64_t polyglotKey(const ChessBoard &board)
+{
+    const Bitboards &bb = board.getBitboards();
+    uint64_t key = 0;
+    for (Color color : { WHITE, BLACK })
+        for (int piece = PAWN; piece <= KING; piece++)
+            for (uint64_t set = bb.pieces(Piece(piece), color); set;)
+            {
+                // Pieces run black pawn, white pawn, black knight, ...; rows from rank 1.
+                int sq = popLsb(set);
+                int kind = (piece - PAWN) * 2 + (color == WHITE ? 1 : 0);
+                key ^= polyglotRandom[64 * kind + 8 * (7 - sq / 8) + sq % 8];
+            }
+    // Same order as our mask: white short, white long, black short, black long.
+    for (int i = 0; i < 4; i++)
+        if (board.getCastlingRights() & (1 << i))
+            key ^= polyglotRandom[768 + i];
+    // The en passant file counts only if a pawn can actually take.
+    Color us = board.getSideToMove(), them = us == WHITE ? BLACK : WHITE;
+    pair<int, int> ep = board.getEnPassantTarget();
+    if (ep.first >= 0 && (pawnAttacks[them][squareIndex(ep.first, ep.second)] & bb.pieces(PAWN, us)))
+        key ^= polyglotRandom[772 + ep.second];
+    if (us == WHITE)
+        key ^= polyglotRandom[780];
+    return key;
+}
+
+// Keys published with the Polyglot book format; the later ones cover the
+// en passant rule.
+struct PolyglotKeyCase
+{
+    const char *moves; // From the start position.
+    uint64_t key;
+};
+
+const PolyglotKeyCase polyglotKeyCases[] = {
+    { "", 0x463b96181691fc9cULL },
+    { "e2e4", 0x823c9b50fd114196ULL },
+    { "e2e4 d7d5", 0x0756b94461c50fb0ULL },
+    { "e2e4 d7d5 e4e5", 0x662fafb965db29d4ULL },
+    { "e2e4 d7d5 e4e5 f7f5", 0x22a48b5a8e47ff78ULL },
+    { "e2e4 d7d5 e4e5 f7f5 e1e2", 0x652a607ca3f242c1ULL },
+    { "e2e4 d7d5 e4e5 f7f5 e1e2 e8f7", 0x00fdd303c946bdd9ULL },
+    { "a2a4 b7b5 h2h4 b5b4 c2c4", 0x3c8123ea7b067637ULL },
+    { "a2a4 b7b5 h2h4 b5b4 c2c4 b4c3 a1a3", 0x5c3f9b829b279560ULL },
+};
+
+// Compares polyglotKey with the published keys; returns the number of mismatches.
+int runPolyglotKeyTest()
+{
+    int failures = 0;
+    for (const PolyglotKeyCase &test : polyglotKeyCases)
+    {
+        ChessBoard board;
+        board.loadFen(startFen);
+        istringstream moves(test.moves);
+        for (string moveText; moves >> moveText;)
+            board.applyMove(parseMove(board, moveText));
+        uint64_t key = polyglotKey(board);
+        cout << hex << setfill('0') << setw(16) << key << dec << setfill(' ') << "  "
+             << (key == test.key ? "OK  " : "FAIL") << "  " << (*test.moves ? test.moves : "start position") << endl;
+        failures += key != test.key;
+    }
+    cout << (failures ? to_string(failures) + " key(s) FAILED" : "All keys passed") << endl;
+    return failures;
+}
+
+// Polyglot move: to file, to row, from file, from row (3 bits each, rows from
+// rank 1), then the promotion piece. Castling is written as the king taking
+// its own rook.
+uint16_t polyglotMove(Move move)
+{
+    int from = move.from(), to = move.to();
+    if (move.type() == CASTLING)
+        to = squareIndex(to / 8, to % 8 == 6 ? 7 : 0);
+    int promo = move.type() == PROMOTION ? move.promotedPiece() - PAWN : 0;
+    return uint16_t(to % 8 | (7 - to / 8) << 3 | (from % 8) << 6 | (7 - from / 8) << 9 | promo << 12);
+}
+
+inline uint64_t readBigEndian(const uint8_t *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = value << 8 | data[i];
+    return value;
+}
+
+inline void writeBigEndian(uint8_t *data, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--, value >>= 8)
+        data[i] = uint8_t(value);
+}
+
+struct BookMove
+{
+    Move move;
+    int weight;
+};
+
+class PolyglotBook
+{
+private:
+    void *mapping = nullptr;
+    size_t mappedBytes = 0;
+    const uint8_t *entries = nullptr;
+    size_t count = 0;
+    PRNG rng{ uint64_t(chrono::steady_clock::now().time_since_epoch().count()) | 1 };
+
+public:
+    PolyglotBook() = default;
+    PolyglotBook(const PolyglotBook &) = delete;
+    PolyglotBook &operator=(const PolyglotBook &) = delete;
+
+    ~PolyglotBook()
+    {
+        release();
+    }
+
+    bool loaded() const
+    {
+        return entries != nullptr;
+    }
+
+    void release()
+    {
+        if (mapping)
+            munmap(mapping, mappedBytes);
+        mapping = nullptr;
+        mappedBytes = count = 0;
+        entries = nullptr;
+    }
+
+    bool load(const string &path)
+    {
+        release();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        void *memory = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0 && info.st_size % 16 == 0)
+            memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            return false;
+        mapping = memory;
+        mappedBytes = info.st_size;
+        entries = static_cast<const uint8_t *>(memory);
+        count = mappedBytes / 16;
+        return true;
+    }
+
+    // The legal moves the book gives for the position; entries that match no
+    // legal move are skipped.
+    vector<BookMove> probe(const ChessBoard &board) const
+    {
+        vector<BookMove> result;
+        if (!loaded())
+            return result;
+        uint64_t key = polyglotKey(board);
+        size_t low = 0, high = count;
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (readBigEndian(entries + 16 * mid, 8) < key)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        MoveList moves = board.getLegalMoves(board.getSideToMove());
+        for (size_t i = low; i < count && readBigEndian(entries + 16 * i, 8) == key; i++)
+        {
+            uint16_t raw = uint16_t(readBigEndian(entries + 16 * i + 8, 2));
+            int weight = int(readBigEndian(entries + 16 * i + 10, 2));
+            for (Move move : moves)
+                if (polyglotMove(move) == (raw & 0x7FFF))
+                {
+                    result.push_back({ move, weight });
+                    break;
+                }
+        }
+        return result;
+    }
+
+    // Picks a book move at random in proportion to the weights, or
+    // Move::none() when the position is not in the book.
+    Move pick(const ChessBoard &board)
+    {
+        vector<BookMove> moves = probe(board);
+        uint64_t total = 0;
+        for (const BookMove &entry : moves)
+            total += entry.weight;
+        if (total == 0)
+            return Move::none();
+        uint64_t target = rng.rand64() % total;
+        for (const BookMove &entry : moves)
+        {
+            if (target < uint64_t(entry.weight))
+                return entry.move;
+            target -= entry.weight;
+        }
+        return Move::none();
+    }
+};
+
+PolyglotBook book;
+bool useBook = false; // UCI OwnBook; the command line uses the book whenever one is given.
+
+struct BookEntry
+{
+    uint64_t key;
+    uint16_t move;
+    uint32_t weight;
+};
+
+// Builds a book from a PGN file (each move of the first maxPly plies scores 2
+// for a win, 1 for a draw or unknown result, 0 for a loss, as Polyglot does)
+// or from an EPD file (one point per "bm" move).
+int runBookBuild(const string &output, const string &input, int maxPly)
+{
+    ifstream in(input);
+    if (!in)
+    {
+        cout << "Cannot open " << input << endl;
+        return 1;
+    }
+    vector<BookEntry> raw;
+    uint64_t games = 0, errors = 0;
+    auto start = chrono::steady_clock::now();
+    string extension = input.substr(input.find_last_of('.') + 1);
+    if (extension == "epd" || extension == "fen")
+    {
+        string line, fen, operations;
+        ChessBoard board;
+        while (getline(in, line))
+        {
+            if (line.empty() || line[0] == '#' || !splitEpd(line, fen, operations) || !board.loadFen(fen))
+                continue;
+            games++;
+            size_t bm = operations.find("bm ");
+            istringstream ops(bm == string::npos ? "" : operations.substr(bm + 3, operations.find(';', bm) - bm - 3));
+            string san;
+            while (ops >> san)
+            {
+                Move move = parseSan(board, san);
+                if (move == Move::none())
+                    errors++;
+                else
+                    raw.push_back({ polyglotKey(board), polyglotMove(move), 1 });
+            }
+        }
+    }
+    else
+    {
+        PgnReader reader;
+        reader.open(input);
+        string text;
+        PgnGame game;
+        ChessBoard board;
+        while (reader.next(text))
+        {
+            parsePgnGame(text, game);
+            games++;
+            if (!board.loadFen(game.fen))
+            {
+                errors++;
+                continue;
+            }
+            for (int ply = 0; ply < (int)game.moves.size() && ply < maxPly; ply++)
+            {
+                Move move = parseSan(board, game.moves[ply]);
+                if (move == Move::none())
+                {
+                    errors++;
+                    break;
+                }
+                int sign = board.getSideToMove() == WHITE ? 1 : -1;
+                uint32_t score = game.result == 2 ? 1 : 1 + game.result * sign;
+                if (score > 0)
+                    raw.push_back({ polyglotKey(board), polyglotMove(move), score });
+                board.applyMove(move);
+            }
+        }
+    }
+
+    // Merge duplicates, then order each position's moves best first.
+    sort(raw.begin(), raw.end(), [](const BookEntry &a, const BookEntry &b) {
+        return a.key != b.key ? a.key < b.key : a.move < b.move;
+    });
+    vector<BookEntry> merged;
+    uint32_t maxWeight = 0;
+    for (const BookEntry &entry : raw)
+    {
+        if (!merged.empty() && merged.back().key == entry.key && merged.back().move == entry.move)
+            merged.back().weight += entry.weight;
+        else
+            merged.push_back(entry);
+        maxWeight = max(maxWeight, merged.back().weight);
+    }
+    stable_sort(merged.begin(), merged.end(), [](const BookEntry &a, const BookEntry &b) {
+        return a.key != b.key ? a.key < b.key : a.weight > b.weight;
+    });
+
+    vector<uint8_t> data(merged.size() * 16, 0);
+    for (size_t i = 0; i < merged.size(); i++)
+    {
+        // Weights are 16 bits; scale down if a count overflows them.
+        uint64_t weight = maxWeight > 65535 ? max<uint64_t>(1, uint64_t(merged[i].weight) * 65535 / maxWeight) : merged[i].weight;
+        writeBigEndian(&data[16 * i], merged[i].key, 8);
+        writeBigEndian(&data[16 * i + 8], merged[i].move, 2);
+        writeBigEndian(&data[16 * i + 10], weight, 2);
+    }
+    FILE *file = fopen(output.c_str(), "wb");
+    bool ok = file && fwrite(data.data(), 1, data.size(), file) == data.size();
+    if (!file || fclose(file) != 0 || !ok)
+    {
+        cout << "Cannot write " << output << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Book " << output << ": " << merged.size() << " entries from " << games << " games or positions ("
+         << errors << " errors) in " << fixed << setprecision(2) << seconds << " s" << endl;
+    return 0;
+}
+
+// "book build <out.bin> <games.pgn|positions.epd> [max ply]" writes a book;
+// "book test" checks the key table against the published keys;
+// "book probe <book.bin> [fen]" lists its moves for a position and times the lookup.
+int runBookCommand(const string &action, const string &path, const string &arg)
+{
+    if (action == "test")
+        return runPolyglotKeyTest() ? 1 : 0;
+    if (action == "build")
+    {
+        istringstream args(arg);
+        string input;
+        int maxPly = 20;
+        args >> input >> maxPly;
+        return runBookBuild(path, input, maxPly);
+    }
+    if (action != "probe" || !book.load(path))
+    {
+        cout << (action == "probe" ? "Cannot map book " + path : "Unknown book command " + action) << endl;
+        return 1;
+    }
+    ChessBoard board;
+    if (!board.loadFen(arg.empty() ? string(startFen) : arg))
+    {
+        cout << "Invalid FEN: " << arg << endl;
+        return 1;
+    }
+    const int repeats = 100000;
+    auto start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (int i = 0; i < repeats; i++)
+        found += book.probe(board).size();
+    double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / repeats;
+    vector<BookMove> moves = book.probe(board);
+    int total = 0;
+    for (const BookMove &entry : moves)
+        total += entry.weight;
+    cout << "Key " << hex << setfill('0') << setw(16) << polyglotKey(board) << dec << setfill(' ') << ": " << moves.size()
+         << " book moves, lookup " << fixed << setprecision(2) << micros << " us" << endl;
+    for (const BookMove &entry : moves)
+        cout << "  " << moveToString(entry.move) << " weight " << entry.weight << " ("
+             << setprecision(1) << 100.0 * entry.weight / max(total, 1) << "%)" << endl;
+    return found ? 0 : 1;
+}
+
+// --- Match Runner ---
+// Plays two configurations of the engine against each other inside this
+// process, each worker thread running one game at a time with a private hash
+// table per engine. Every opening is played twice with colours reversed, and
+// the results of these game pairs feed a sequential probability ratio test
+// that ends the match as soon as either hypothesis is accepted.
+//
+// An engine is a comma-separated list of settings, such as "nodes=20000" or
+// "tc=10+0.1,hash=16,eval=classical": nodes, depth, movetime (ms) and tc
+// (seconds plus increment) limit each move, hash sets the table size in MB
+// and eval=classical ignores the network loaded with evalfile.
+
+struct EngineConfig
+{
+    string text;
+    SearchLimits limits;
+    int64_t baseTime = 0, increment = 0; // Game clock in milliseconds; 0 = none.
+    int hashMB = 8;
+    bool classicalEval = false;
+};
+
+bool parseEngineConfig(const string &text, EngineConfig &config)
+{
+    config.text = text;
+    istringstream iss(text);
+    string item;
+    while (getline(iss, item, ','))
+    {
+        size_t split = item.find('=');
+        if (split == string::npos)
+            return false;
+        string key = item.substr(0, split), value = item.substr(split + 1);
+        if (key == "nodes")
+            config.limits.nodes = strtoull(value.c_str(), nullptr, 10);
+        else if (key == "depth")
+            config.limits.depth = clamp(atoi(value.c_str()), 1, MAX_PLY - 1);
+        else if (key == "movetime")
+            config.limits.movetime = atoll(value.c_str());
+        else if (key == "tc")
+        {
+            size_t plus = value.find('+');
+            config.baseTime = int64_t(atof(value.substr(0, plus).c_str()) * 1000);
+            config.increment = plus == string::npos ? 0 : int64_t(atof(value.substr(plus + 1).c_str()) * 1000);
+        }
+        else if (key == "hash")
+            config.hashMB = clamp(atoi(value.c_str()), 1, 65536);
+        else if (key == "eval" && (value == "classical" || (value == "nnue" && network.loaded)))
+            config.classicalEval = value == "classical";
+        else
+            return false;
+    }
+    // Without a limit every move would be searched to MAX_PLY.
+    return config.limits.nodes || config.limits.depth < MAX_PLY - 1 || config.limits.movetime || config.baseTime;
+}
+
+struct MatchEngine
+{
+    const EngineConfig &config;
+    SharedSearch shared;
+    TranspositionTable tt;
+    Searcher searcher{ 0, shared };
+
+    MatchEngine(const EngineConfig &engineConfig) : config(engineConfig)
+    {
+        if (!tt.resize(config.hashMB))
+            tt.resize(1);
+        shared.tt = &tt;
+        shared.classicalEval = config.classicalEval;
+    }
+
+    SearchResult think(const ChessBoard &board, const SearchLimits &limits)
+    {
+        shared.begin(board, limits, false, 1);
+        searcher.prepare(board);
+        searcher.think();
+        return searcher.result;
+    }
+};
+
+// Bare kings, or a single minor piece against a bare king.
+bool insufficientMaterial(const ChessBoard &board)
+{
+    int minors = 0;
+    for (int sq = 0; sq < 64; sq++)
+    {
+        Piece piece = board.pieceAt(sq).piece;
+        if (piece == PAWN || piece == ROOK || piece == QUEEN)
+            return false;
+        minors += piece == KNIGHT || piece == BISHOP;
+    }
+    return minors <= 1;
+}
+
+// Adjudication: a game is drawn once both sides have scored within
+// drawScore for drawPlies consecutive plies after drawStartPly, and won once
+// both agree on a margin of resignScore for resignPlies plies. Positions in
+// the loaded tablebases are scored from the tables.
+const int drawStartPly = 80, drawPlies = 8, drawScore = 10;
+const int resignPlies = 6, resignScore = 1000;
+const int maxGamePlies = 600;
+
+// Plays one game from fen between players[0] (White) and players[1] (Black).
+// Returns 1, 0 or -1 from White's point of view, or 2 if abort was raised.
+// If given, onMove sees each position with the search that chose its move.
+int playMatchGame(MatchEngine *players[2], const string &fen, const atomic<bool> &abort, string &reason,
+                  function<void(const ChessBoard &, const SearchResult &)> onMove = nullptr)
+{
+    ChessBoard board;
+    board.loadFen(fen);
+    for (int side = 0; side < 2; side++)
+        players[side]->tt.clear();
+    int64_t clock[2] = { players[0]->config.baseTime, players[1]->config.baseTime };
+    int drawCount = 0, resignCount = 0; // resignCount is positive while White is winning.
+    while (!abort.load(memory_order_relaxed))
+    {
+        Color us = board.getSideToMove();
+        int side = us == WHITE ? 0 : 1, sign = us == WHITE ? 1 : -1;
+        if (board.getLegalMoves(us).size() == 0)
+        {
+            bool mated = board.isKingInCheck(us);
+            reason = mated ? "checkmate" : "stalemate";
+            return mated ? -sign : 0;
+        }
+        int repetitions = 0;
+        for (int i = 4; i <= min(board.getHalfmoveClock(), board.gamePly()); i += 2)
+            repetitions += board.keyAt(board.gamePly() - i) == board.getKey();
+        if (repetitions >= 2 || board.getHalfmoveClock() >= 100 || insufficientMaterial(board) ||
+            board.gamePly() >= maxGamePlies)
+        {
+            reason = repetitions >= 2 ? "repetition" : board.getHalfmoveClock() >= 100 ? "fifty moves"
+                     : board.gamePly() >= maxGamePlies ? "length" : "insufficient material";
+            return 0;
+        }
+        int wdl, dtm;
+        if (tablebases.count && tablebases.probe(board, wdl, dtm))
+        {
+            reason = "tablebase";
+            return wdl * sign;
+        }
+
+        MatchEngine &engine = *players[side];
+        SearchLimits limits = engine.config.limits;
+        if (engine.config.baseTime)
+        {
+            limits.time[us] = clock[side];
+            limits.inc[us] = engine.config.increment;
+        }
+        auto start = chrono::steady_clock::now();
+        SearchResult result = engine.think(board, limits);
+        if (engine.config.baseTime)
+        {
+            clock[side] -= chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+            if (clock[side] < 0)
+            {
+                reason = "time forfeit";
+                return -sign;
+            }
+            clock[side] += engine.config.increment;
+        }
+
+        if (onMove)
+            onMove(board, result);
+        int score = result.score * sign;
+        drawCount = board.gamePly() >= drawStartPly && abs(score) <= drawScore ? drawCount + 1 : 0;
+        resignCount = score >= resignScore ? max(resignCount, 0) + 1 : score <= -resignScore ? min(resignCount, 0) - 1 : 0;
+        if (drawCount >= drawPlies || abs(resignCount) >= resignPlies)
+        {
+            reason = "adjudication";
+            return drawCount >= drawPlies ? 0 : resignCount > 0 ? 1 : -1;
+        }
+        board.applyMove(result.bestMove);
+    }
+    return 2;
+}
+
+double eloToScore(double elo)
+{
+    return 1 / (1 + pow(10, -elo / 400));
+}
+
+double scoreToElo(double score)
+{
+    score = clamp(score, 1e-4, 1 - 1e-4);
+    return -400 * log10(1 / score - 1);
+}
+
+// Results from the first engine's side. A pair's points (0 to 2 in steps of
+// a half) index the pentanomial counts, which are the samples of the test:
+// the two games of a pair share an opening, so they are not independent.
+struct MatchStats
+{
+    uint64_t wins = 0, losses = 0, draws = 0;
+    uint64_t pairs[5] = {};
+
+    // Mean and variance of the per-game score over the finished pairs.
+    uint64_t pairStats(double &mean, double &variance) const
+    {
+        // A quarter of a pair in every cell keeps the variance positive when all
+        // pairs so far ended alike, and the first few pairs from deciding a test.
+        const double prior = 0.25;
+        uint64_t count = 0;
+        double total = 0, sum = 0, squares = 0;
+        for (int i = 0; i < 5; i++)
+        {
+            count += pairs[i];
+            total += pairs[i] + prior;
+            sum += (pairs[i] + prior) * i / 4.0;
+            squares += (pairs[i] + prior) * (i / 4.0) * (i / 4.0);
+        }
+        mean = sum / total;
+        variance = squares / total - mean * mean;
+        return count;
+    }
+
+    // Generalized SPRT log-likelihood ratio of elo1 against elo0 under the
+    // normal approximation.
+    double llr(double elo0, double elo1) const
+    {
+        double mean, variance;
+        uint64_t count = pairStats(mean, variance);
+        if (count == 0 || variance <= 0)
+            return 0;
+        double s0 = eloToScore(elo0), s1 = eloToScore(elo1);
+        return count * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+    }
+
+    string summary() const
+    {
+        double mean, variance;
+        uint64_t count = pairStats(mean, variance);
+        double margin = count ? 1.96 * sqrt(variance / count) : 0;
+        double elo = scoreToElo(mean);
+        ostringstream out;
+        out << "Games " << wins + losses + draws << ": +" << wins << " -" << losses << " =" << draws << "  pairs ["
+            << pairs[0] << " " << pairs[1] << " " << pairs[2] << " " << pairs[3] << " " << pairs[4] << "]  Elo " << fixed
+            << setprecision(1) << elo << " +- " << (scoreToElo(mean + margin) - scoreToElo(mean - margin)) / 2;
+        return out.str();
+    }
+};
+
+// "match <engine A> <engine B> [games <n>] [concurrency <n>] [openings <epd>]
+// [sprt <elo0> <elo1>] [alpha <a>] [beta <b>]"
+int runMatch(const vector<string> &args)
+{
+    EngineConfig configs[2];
+    if (args.size() < 2 || !parseEngineConfig(args[0], configs[0]) || !parseEngineConfig(args[1], configs[1]))
+    {
+        cout << "Engines need a limit, such as \"nodes=20000\" or \"tc=10+0.1,hash=16,eval=classical\"\n"
+             << "(eval=nnue needs a network loaded with evalfile)" << endl;
+        return 1;
+    }
+    uint64_t games = 100;
+    int concurrency = max(1, int(thread::hardware_concurrency()));
+    string openingsPath;
+    bool sprt = false;
+    double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+    for (size_t i = 2; i + 1 < args.size(); i++)
+    {
+        if (args[i] == "games")
+            games = strtoull(args[++i].c_str(), nullptr, 10);
+        else if (args[i] == "concurrency")
+            concurrency = max(1, atoi(args[++i].c_str()));
+        else if (args[i] == "openings")
+            openingsPath = args[++i];
+        else if (args[i] == "sprt" && i + 2 < args.size())
+        {
+            sprt = true;
+            elo0 = atof(args[++i].c_str());
+            elo1 = atof(args[++i].c_str());
+        }
+        else if (args[i] == "alpha")
+            alpha = clamp(atof(args[++i].c_str()), 1e-6, 0.5);
+        else if (args[i] == "beta")
+            beta = clamp(atof(args[++i].c_str()), 1e-6, 0.5);
+    }
+    games += games % 2; // Whole pairs only.
+
+    vector<string> openings;
+    if (!openingsPath.empty())
+    {
+        ifstream file(openingsPath);
+        if (!file)
+        {
+            cout << "Cannot open " << openingsPath << endl;
+            return 1;
+        }
+        string line, fen, operations;
+        ChessBoard board;
+        while (getline(file, line))
+            if (!line.empty() && line[0] != '#' && splitEpd(line, fen, operations) && board.loadFen(fen) &&
+                board.getLegalMoves(board.getSideToMove()).size() > 0)
+                openings.push_back(fen);
+    }
+    if (openings.empty())
+        openings.push_back(startFen);
+
+    double lower = log(beta / (1 - alpha)), upper = log((1 - beta) / alpha);
+    cout << "Match " << configs[0].text << " vs " << configs[1].text << ", " << games << " games, " << concurrency
+         << " threads, " << openings.size() << " openings";
+    if (sprt)
+        cout << ", SPRT elo0 " << elo0 << " elo1 " << elo1 << " bounds [" << fixed << setprecision(2) << lower << ", "
+             << upper << "]";
+    cout << endl;
+
+    atomic<uint64_t> nextGame{ 0 };
+    atomic<bool> decided{ false };
+    mutex statsLock;
+    MatchStats stats;
+    map<string, uint64_t> endings;
+    vector<int8_t> firstOfPair(games / 2, -1); // Points of the pair's finished game.
+    auto start = chrono::steady_clock::now();
+
+    auto worker = [&] {
+        auto a = make_unique<MatchEngine>(configs[0]), b = make_unique<MatchEngine>(configs[1]);
+        while (!decided)
+        {
+            uint64_t game = nextGame++;
+            if (game >= games)
+                break;
+            bool aWhite = game % 2 == 0;
+            MatchEngine *players[2] = { aWhite ? a.get() : b.get(), aWhite ? b.get() : a.get() };
+            string reason;
+            int result = playMatchGame(players, openings[game / 2 % openings.size()], decided, reason);
+            if (result == 2)
+                break;
+            int points = aWhite ? result + 1 : 1 - result; // Engine A's, in half points.
+
+            lock_guard<mutex> guard(statsLock);
+            if (decided)
+                break;
+            endings[reason]++;
+            (points == 2 ? stats.wins : points == 0 ? stats.losses : stats.draws)++;
+            int8_t &first = firstOfPair[game / 2];
+            if (first < 0)
+                first = points;
+            else
+                stats.pairs[first + points]++;
+            uint64_t played = stats.wins + stats.losses + stats.draws;
+            double llr = stats.llr(elo0, elo1);
+            if (sprt && (llr <= lower || llr >= upper))
+                decided = true;
+            if (played % 10 == 0 || decided)
+            {
+                cout << stats.summary();
+                if (sprt)
+                    cout << "  LLR " << fixed << setprecision(2) << llr;
+                cout << endl;
+            }
+        }
+        telemetryFlush();
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < concurrency; i++)
+        workers.emplace_back(worker);
+    for (thread &t : workers)
+        t.join();
+
+    double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+    uint64_t played = stats.wins + stats.losses + stats.draws;
+    cout << "\n" << stats.summary() << "  time " << fixed << setprecision(1) << seconds << " s  games/s " << setprecision(2)
+         << played / seconds << endl;
+    cout << "Endings:";
+    for (auto &ending : endings)
+        cout << " " << ending.first << " " << ending.second;
+    cout << endl;
+    if (sprt)
+    {
+        double llr = stats.llr(elo0, elo1);
+        cout << "LLR " << setprecision(2) << llr << " [" << lower << ", " << upper << "]: "
+             << (llr >= upper ? "H1 accepted" : llr <= lower ? "H0 accepted" : "inconclusive") << endl;
+    }
+    return 0;
+}
+
+// --- Training Data ---
+// "datagen play" has every core play self-play games with one engine setting
+// and records the quiet positions with the search score and the final
+// result; "datagen read" streams a file back as text.
+//
+// A record is 32 bytes, in the layout of the marlinformat used by common
+// NNUE trainers: squares count from a1 = 0, the occupied squares are listed
+// as a bitboard followed by a nibble per piece in square order, and rooks
+// that may still castle get their own piece code. Fields are little-endian,
+// like the host. Each thread fills its own buffer and appends it with
+// pwrite at an offset reserved atomically, so writers never wait on a lock.
+
+struct PackedPosition
+{
+    uint64_t occupancy;      // Bit per square, a1 = bit 0.
+    uint8_t pieces[16];      // Low nibble first: PAWN-1 .. KING-1, 6 = castling rook, +8 for Black.
+    uint8_t stmEp;           // Bit 7 set with Black to move; en passant square or 64.
+    uint8_t halfmoveClock;
+    uint16_t fullmoveNumber;
+    int16_t score;           // Centipawns for White.
+    uint8_t result;          // 0 = Black won, 1 = draw, 2 = White won.
+    uint8_t extra;
+};
 
-    // Castling rights flags.
-    bool whiteKingMoved, blackKingMoved;
-    bool whiteRookAMoved, whiteRookHMoved;
-    bool blackRookAMoved, blackRookHMoved;
+static_assert(sizeof(PackedPosition) == 32, "records are 32 bytes");
 
-public:
-    ChessBoard()
+const int PACKED_CASTLING_ROOK = 6;
+
+PackedPosition packPosition(const ChessBoard &board, int whiteScore, int result)
+{
+    PackedPosition record = {};
+    int rights = board.getCastlingRights();
+    // The rook squares behind each castling right, a1 = 0.
+    const int castlingRooks[4] = { 7, 0, 63, 56 };
+    int count = 0;
+    for (int sq = 0; sq < 64; sq++)
     {
-        board.resize(8, vector<Square>(8));
-        enPassantTarget = { -1, -1 };
-        whiteKingMoved = blackKingMoved = false;
-        whiteRookAMoved = whiteRookHMoved = false;
-        blackRookAMoved = blackRookHMoved = false;
-        initializeBoard();
+        Square square = board.pieceAt(sq ^ 56);
+        if (square.piece == EMPTY)
+            continue;
+        int code = square.piece - 1;
+        for (int i = 0; i < 4; i++)
+            if ((rights & (1 << i)) && castlingRooks[i] == sq && square.piece == ROOK)
+                code = PACKED_CASTLING_ROOK;
+        code |= square.color == BLACK ? 8 : 0;
+        record.occupancy |= 1ULL << sq;
+        record.pieces[count / 2] |= code << (count % 2 * 4);
+        count++;
     }
+    pair<int, int> ep = board.getEnPassantTarget();
+    record.stmEp = (board.getSideToMove() == BLACK ? 0x80 : 0) | (ep.first >= 0 ? (7 - ep.first) * 8 + ep.second : 64);
+    record.halfmoveClock = min(board.getHalfmoveClock(), 255);
+    record.fullmoveNumber = min(board.getFullmoveNumber(), 65535);
+    record.score = clamp(whiteScore, -32767, 32767);
+    record.result = result + 1;
+    return record;
+}
 
-    void initializeBoard()
+string unpackFen(const PackedPosition &record)
+{
+    char squares[64];
+    int rights = 0, count = 0;
+    for (int sq = 0; sq < 64; sq++)
     {
-        // Initialize pawns.
-        for (int i = 0; i < 8; i++)
+        squares[sq] = 0;
+        if (!(record.occupancy >> sq & 1))
+            continue;
+        int code = record.pieces[count / 2] >> (count % 2 * 4) & 15;
+        count++;
+        int piece = code & 7;
+        if (piece == PACKED_CASTLING_ROOK)
         {
-            board[1][i] = Square(PAWN, BLACK);
-            board[6][i] = Square(PAWN, WHITE);
+            rights |= sq == 7 ? 1 : sq == 0 ? 2 : sq == 63 ? 4 : sq == 56 ? 8 : 0;
+            piece = ROOK - 1;
         }
-        // Black pieces.
-        board[0][0] = board[0][7] = Square(ROOK, BLACK);
-        board[0][1] = board[0][6] = Square(KNIGHT, BLACK);
-        board[0][2] = board[0][5] = Square(BISHOP, BLACK);
-        board[0][3] = Square(QUEEN, BLACK);
-        board[0][4] = Square(KING, BLACK);
-        // White pieces.
-        board[7][0] = board[7][7] = Square(ROOK, WHITE);
-        board[7][1] = board[7][6] = Square(KNIGHT, WHITE);
-        board[7][2] = board[7][5] = Square(BISHOP, WHITE);
-        board[7][3] = Square(QUEEN, WHITE);
-        board[7][4] = Square(KING, WHITE);
+        char c = "PNBRQK"[min(piece, 5)];
+        squares[sq] = code & 8 ? char(tolower(c)) : c;
     }
-
-    // A helper to let us access a square (used in user input processing).
-    Square getSquare(int row, int col) const
-    {
-        return board[row][col];
-    }
-
-    void printBoard()
+    string fen;
+    for (int rank = 7; rank >= 0; rank--)
     {
-        cout << "\n  0 1 2 3 4 5 6 7\n";
-        for (int row = 0; row < 8; row++)
+        int empty = 0;
+        for (int file = 0; file < 8; file++)
         {
-            cout << row << " ";
-            for (int col = 0; col < 8; col++)
+            char c = squares[rank * 8 + file];
+            if (!c)
             {
-                char pieceChar = '.';
-                if (board[row][col].piece != EMPTY)
-                    pieceChar = getPieceChar(board[row][col]);
-                cout << pieceChar << " ";
+                empty++;
+                continue;
             }
-            cout << endl;
+            if (empty)
+                fen += char('0' + empty);
+            empty = 0;
+            fen += c;
         }
+        if (empty)
+            fen += char('0' + empty);
+        if (rank > 0)
+            fen += '/';
     }
+    fen += record.stmEp & 0x80 ? " b " : " w ";
+    string castling;
+    for (int i = 0; i < 4; i++)
+        if (rights & (1 << i))
+            castling += "KQkq"[i];
+    fen += castling.empty() ? "-" : castling;
+    int ep = record.stmEp & 0x7f;
+    fen += ep < 64 ? " " + string(1, char('a' + ep % 8)) + char('1' + ep / 8) : string(" -");
+    return fen + " " + to_string(record.halfmoveClock) + " " + to_string(record.fullmoveNumber);
+}
 
-    char getPieceChar(const Square &square) const
+// "datagen play <out> <engine> [positions <n>] [threads <n>] [random <plies>]
+// [seed <n>]". Games open with random moves and are dropped when the first
+// search already sees a decided position. Positions in check, mate scores
+// and positions whose chosen move captures or promotes are not recorded.
+int runDatagen(const vector<string> &args)
+{
+    EngineConfig config;
+    if (args.size() < 2 || !parseEngineConfig(args[1], config))
     {
-        char pieceChar = '.';
-        switch (square.piece)
-        {
-        case PAWN:
-            pieceChar = 'P';
-            break;
-        case KNIGHT:
-            pieceChar = 'N';
-            break;
-        case BISHOP:
-            pieceChar = 'B';
-            break;
-        case ROOK:
-            pieceChar = 'R';
-            break;
-        case QUEEN:
-            pieceChar = 'Q';
-            break;
-        case KING:
-            pieceChar = 'K';
-            break;
-        default:
-            pieceChar = '.';
-            break;
-        }
-        return square.color == BLACK ? tolower(pieceChar) : pieceChar;
+        cout << "The engine needs a limit, such as \"depth=8\" or \"nodes=5000\"" << endl;
+        return 1;
+    }
+    uint64_t target = 1000000, seed = chrono::steady_clock::now().time_since_epoch().count();
+    int threadCount = max(1, int(thread::hardware_concurrency())), randomPlies = 8;
+    for (size_t i = 2; i + 1 < args.size(); i++)
+    {
+        if (args[i] == "positions")
+            target = strtoull(args[++i].c_str(), nullptr, 10);
+        else if (args[i] == "threads")
+            threadCount = max(1, atoi(args[++i].c_str()));
+        else if (args[i] == "random")
+            randomPlies = max(0, atoi(args[++i].c_str()));
+        else if (args[i] == "seed")
+            seed = strtoull(args[++i].c_str(), nullptr, 10);
+    }
+    int fd = open(args[0].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        cout << "Cannot create " << args[0] << endl;
+        return 1;
     }
+    cout << "Generating " << target << " positions with " << config.text << " on " << threadCount << " threads, "
+         << randomPlies << " random plies, seed " << seed << endl;
 
-    // --- Pseudo-Legal Move Generation Functions ---
+    const size_t bufferRecords = 1 << 14; // 512 KB per thread.
+    atomic<uint64_t> reserved{ 0 }, games{ 0 }, fileOffset{ 0 };
+    atomic<bool> done{ false }, failed{ false };
+    auto start = chrono::steady_clock::now();
 
-    void generatePawnMoves(set<Move> &moves, int row, int col, Color color)
-    {
-        int direction = (color == WHITE) ? -1 : 1;
-        int newRow = row + direction;
-        if (newRow >= 0 && newRow < 8 && board[newRow][col].piece == EMPTY)
+    auto flush = [&](vector<PackedPosition> &buffer) {
+        size_t bytes = buffer.size() * sizeof(PackedPosition);
+        off_t offset = fileOffset.fetch_add(bytes);
+        if (bytes && pwrite(fd, buffer.data(), bytes, offset) != ssize_t(bytes))
+            failed = true;
+        buffer.clear();
+    };
+
+    auto worker = [&](int id) {
+        auto engine = make_unique<MatchEngine>(config);
+        MatchEngine *players[2] = { engine.get(), engine.get() };
+        PRNG rng(seed * 0x9E3779B97F4A7C15ULL + id + 1);
+        vector<PackedPosition> buffer, game;
+        buffer.reserve(bufferRecords);
+        while (!done && !failed)
         {
-            bool isPromotion = (color == WHITE && newRow == 0) || (color == BLACK && newRow == 7);
-            if (isPromotion)
-            {
-                vector<Piece> promotions = { QUEEN, ROOK, BISHOP, KNIGHT };
-                for (Piece promo : promotions)
-                    moves.insert(Move(PAWN, color, { row, col }, { newRow, col }, promo));
-            }
-            else
+            ChessBoard board;
+            board.loadFen(startFen);
+            for (int ply = 0; ply < randomPlies; ply++)
             {
-                moves.insert(Move(PAWN, color, { row, col }, { newRow, col }));
-                if ((color == WHITE && row == 6) || (color == BLACK && row == 1))
-                {
-                    int doubleRow = row + 2 * direction;
-                    if (doubleRow >= 0 && doubleRow < 8 && board[doubleRow][col].piece == EMPTY)
-                        moves.insert(Move(PAWN, color, { row, col }, { doubleRow, col }));
-                }
+                MoveList moves = board.getLegalMoves(board.getSideToMove());
+                if (moves.size() == 0)
+                    break;
+                board.applyMove(moves[rng.rand64() % moves.size()]);
             }
-        }
-        // Captures.
-        for (int dcol : { -1, 1 })
-        {
-            int targetCol = col + dcol;
-            if (targetCol < 0 || targetCol >= 8)
+            if (board.getLegalMoves(board.getSideToMove()).size() == 0)
                 continue;
-            if (newRow >= 0 && newRow < 8)
+            engine->tt.clear();
+            if (abs(engine->think(board, config.limits).score) > resignScore)
+                continue;
+
+            game.clear();
+            string reason;
+            int result = playMatchGame(players, board.toFen(), done, reason,
+                                       [&](const ChessBoard &position, const SearchResult &search) {
+                                           Move move = search.bestMove;
+                                           if (position.isKingInCheck(position.getSideToMove()) ||
+                                               abs(search.score) >= MATE_BOUND || move.type() == PROMOTION ||
+                                               move.type() == EN_PASSANT || position.pieceAt(move.to()).piece != EMPTY)
+                                               return;
+                                           int sign = position.getSideToMove() == WHITE ? 1 : -1;
+                                           game.push_back(packPosition(position, search.score * sign, 0));
+                                       });
+            if (result == 2)
+                break;
+            uint64_t first = reserved.fetch_add(game.size());
+            if (first >= target)
+                break;
+            size_t keep = min<uint64_t>(game.size(), target - first);
+            for (size_t i = 0; i < keep; i++)
             {
-                Square target = board[newRow][targetCol];
-                if (target.color != color && target.color != NONE)
+                game[i].result = result + 1;
+                buffer.push_back(game[i]);
+                if (buffer.size() == bufferRecords)
                 {
-                    bool isPromotion = (color == WHITE && newRow == 0) || (color == BLACK && newRow == 7);
-                    if (isPromotion)
-                    {
-                        vector<Piece> promotions = { QUEEN, ROOK, BISHOP, KNIGHT };
-                        for (Piece promo : promotions)
-                            moves.insert(Move(PAWN, color, { row, col }, { newRow, targetCol }, promo));
-                    }
-                    else
-                    {
-                        moves.insert(Move(PAWN, color, { row, col }, { newRow, targetCol }));
-                    }
+                    flush(buffer);
+                    double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+                    uint64_t written = fileOffset / sizeof(PackedPosition);
+                    lock_guard<mutex> guard(outputLock);
+                    cout << "positions " << written << "  games " << games << "  positions/h "
+                         << (uint64_t)(written / seconds * 3600) << endl;
                 }
             }
+            games++;
+            if (first + game.size() >= target)
+                done = true;
         }
-        // En passant.
-        if (enPassantTarget.first != -1)
-        {
-            int epRow = enPassantTarget.first;
-            int epCol = enPassantTarget.second;
-            if ((color == WHITE && row == 3) || (color == BLACK && row == 4))
-            {
-                if (epRow == newRow && abs(epCol - col) == 1)
-                    moves.insert(Move(PAWN, color, { row, col }, { epRow, epCol }));
-            }
-        }
-    }
+        flush(buffer);
+        telemetryFlush();
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < threadCount; i++)
+        workers.emplace_back(worker, i);
+    for (thread &t : workers)
+        t.join();
+    close(fd);
 
-    void generateKnightMoves(set<Move> &moves, int row, int col, Color color)
+    double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+    uint64_t written = fileOffset / sizeof(PackedPosition);
+    cout << "Wrote " << written << " positions from " << games << " games to " << args[0] << " in " << fixed
+         << setprecision(1) << seconds << " s (" << (uint64_t)(written / seconds * 3600) << " positions/h)" << endl;
+    if (failed)
+        cout << "Write error on " << args[0] << endl;
+    return failed ? 1 : 0;
+}
+
+// "datagen read <file> [limit]" prints "fen | score | result" per record, the
+// score in centipawns and the result as 1, 0.5 or 0, both for White.
+int runDatagenRead(const string &path, uint64_t limit)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        int knightMoves[8][2] = { { -2, -1 }, { -2, 1 }, { -1, -2 }, { -1, 2 },
-                                  { 1, -2 }, { 1, 2 }, { 2, -1 }, { 2, 1 } };
-        for (auto &m : knightMoves)
-        {
-            int newRow = row + m[0], newCol = col + m[1];
-            if (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8)
-                if (board[newRow][newCol].color != color)
-                    moves.insert(Move(KNIGHT, color, { row, col }, { newRow, newCol }));
-        }
+        cout << "Cannot open " << path << endl;
+        return 1;
     }
-
-    void generateBishopMoves(set<Move> &moves, int row, int col, Color color)
+    vector<PackedPosition> records(1 << 14);
+    uint64_t count = 0, invalid = 0, results[3] = {};
+    size_t pending = 0; // Bytes of a record split across reads.
+    ChessBoard board;
+    string out;
+    while (count < limit)
     {
-        int directions[4][2] = { { -1, -1 }, { -1, 1 }, { 1, -1 }, { 1, 1 } };
-        for (auto &dir : directions)
+        ssize_t got = read(fd, reinterpret_cast<char *>(records.data()) + pending,
+                           records.size() * sizeof(PackedPosition) - pending);
+        if (got <= 0)
+            break;
+        size_t bytes = pending + got, whole = bytes / sizeof(PackedPosition);
+        out.clear();
+        for (size_t i = 0; i < whole && count < limit; i++, count++)
         {
-            int r = row, c = col;
-            while (true)
+            const PackedPosition &record = records[i];
+            string fen = unpackFen(record);
+            if (record.result > 2 || !board.loadFen(fen))
             {
-                r += dir[0];
-                c += dir[1];
-                if (r < 0 || r >= 8 || c < 0 || c >= 8)
-                    break;
-                if (board[r][c].color == color)
-                    break;
-                moves.insert(Move(BISHOP, color, { row, col }, { r, c }));
-                if (board[r][c].color != NONE)
-                    break;
+                invalid++;
+                continue;
             }
+            results[record.result]++;
+            out += fen + " | " + to_string(record.score) + " | " +
+                   (record.result == 2 ? "1" : record.result == 1 ? "0.5" : "0") + "\n";
         }
+        cout << out;
+        pending = bytes - whole * sizeof(PackedPosition);
+        memmove(records.data(), records.data() + whole, pending);
     }
+    close(fd);
+    cerr << "Records " << count << " (" << invalid << " invalid): White won " << results[2] << ", drawn "
+         << results[1] << ", Black won " << results[0] << endl;
+    return invalid ? 1 : 0;
+}
 
-    void generateRookMoves(set<Move> &moves, int row, int col, Color color)
+// --- UCI ---
+// The protocol loop reads commands on the calling thread while searches run
+// on the thread pool, so stop and isready are answered immediately.
+
+void uciPosition(ChessBoard &board, istringstream &iss)
+{
+    string token, fen;
+    iss >> token;
+    if (token == "startpos")
+        fen = startFen;
+    else if (token == "fen")
+        while (iss >> token && token != "moves")
+            fen += token + " ";
+    else
+        return;
+    if (!board.loadFen(fen))
     {
-        int directions[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
-        for (auto &dir : directions)
+        sendLine("info string invalid fen " + fen);
+        return;
+    }
+    if (token != "moves")
+        iss >> token;
+    while (iss >> token)
+    {
+        Move move = parseMove(board, token);
+        if (move == Move::none())
         {
-            int r = row, c = col;
-            while (true)
-            {
-                r += dir[0];
-                c += dir[1];
-                if (r < 0 || r >= 8 || c < 0 || c >= 8)
-                    break;
-                if (board[r][c].color == color)
-                    break;
-                moves.insert(Move(ROOK, color, { row, col }, { r, c }));
-                if (board[r][c].color != NONE)
-                    break;
-            }
+            sendLine("info string illegal move " + token);
+            return;
         }
+        board.applyMove(move);
     }
+}
+
+// "stats" prints the telemetry totals as info strings, "stats json" as one
+// JSON line and "stats reset" clears them. A running search is counted once it
+// finishes.
+void uciStats(istringstream &iss)
+{
+    string mode;
+    iss >> mode;
+    if (!telemetryEnabled)
+        sendLine("info string telemetry not compiled in (build with -DTELEMETRY)");
+    else if (mode == "reset")
+        telemetryReset();
+    else if (mode == "json")
+        sendLine(telemetrySnapshot().toJson());
+    else
+        for (const string &text : telemetrySnapshot().toText())
+            sendLine("info string " + text);
+}
 
-    void generateQueenMoves(set<Move> &moves, int row, int col, Color color)
+void uciSetOption(istringstream &iss)
+{
+    string token, name, value;
+    iss >> token; // "name"
+    while (iss >> token && token != "value")
+        name += (name.empty() ? "" : " ") + token;
+    while (iss >> token)
+        value += (value.empty() ? "" : " ") + token;
+    for (char &c : name)
+        c = tolower(c);
+
+    if (name == "hash")
+    {
+        if (!TT.resize(clamp(atoi(value.c_str()), 1, 65536)))
+            TT.resize(16);
+    }
+    else if (name == "threads")
+        Threads.setThreadCount(clamp(atoi(value.c_str()), 1, 512));
+    else if (name == "clear hash")
+        TT.clear(Threads.size());
+    else if (name == "evalfile")
+    {
+        // Cached evaluations belong to the old evaluator.
+        TT.clear(Threads.size());
+        if (value.empty() || value == "<empty>")
+            network.release();
+        else if (network.load(value))
+            sendLine("info string loaded network " + value + " (" + simdName() + ")");
+        else
+            sendLine("info string cannot load network " + value);
+    }
+    else if (name == "ownbook" || name == "bookfile")
+    {
+        if (name == "ownbook")
+            useBook = value == "true";
+        else if (value.empty() || value == "<empty>")
+            book.release();
+        else if (!book.load(value))
+            sendLine("info string cannot map book " + value);
+    }
+    else if (name == "tablebasepath")
     {
-        generateRookMoves(moves, row, col, color);
-        generateBishopMoves(moves, row, col, color);
+        if (value.empty() || value == "<empty>")
+            tablebases.release();
+        else
+            sendLine("info string found " + to_string(tablebases.load(value)) + " tablebases in " + value);
     }
+    else if (name != "ponder")
+        sendLine("info string unknown option " + name);
+}
+
+void uciIdentify()
+{
+    sendLine("id name ChessBoard");
+    sendLine("id author ChessBoard authors");
+    sendLine("option name Hash type spin default 16 min 1 max 65536");
+    sendLine("option name Threads type spin default 1 min 1 max 512");
+    sendLine("option name Clear Hash type button");
+    sendLine("option name Ponder type check default false");
+    sendLine("option name EvalFile type string default <empty>");
+    sendLine("option name TablebasePath type string default <empty>");
+    sendLine("option name OwnBook type check default false");
+    sendLine("option name BookFile type string default <empty>");
+    sendLine("uciok");
+}
+
+int runUci()
+{
+    ChessBoard board;
+    string line, command;
+    uciIdentify();
 
-    void generateKingMoves(set<Move> &moves, int row, int col, Color color)
+    while (getline(cin, line))
     {
-        int directions[8][2] = { { -1, -1 }, { -1, 0 }, { -1, 1 },
-                                 { 0, -1 },            { 0, 1 },
-                                 { 1, -1 },  { 1, 0 }, { 1, 1 } };
-        for (auto &dir : directions)
+        istringstream iss(line);
+        command.clear();
+        iss >> command;
+        if (command == "quit")
+            break;
+        else if (command == "uci")
+            uciIdentify();
+        else if (command == "isready")
+            sendLine("readyok");
+        else if (command == "ucinewgame")
         {
-            int r = row + dir[0], c = col + dir[1];
-            if (r >= 0 && r < 8 && c >= 0 && c < 8)
-                if (board[r][c].color != color)
-                    moves.insert(Move(KING, color, { row, col }, { r, c }));
+            Threads.wait();
+            TT.clear(Threads.size());
         }
-        // --- Castling ---
-        if (color == WHITE && !whiteKingMoved && row == 7 && col == 4)
+        else if (command == "position")
         {
-            // Kingside castling.
-            if (!whiteRookHMoved && board[7][5].piece == EMPTY && board[7][6].piece == EMPTY)
-            {
-                if (!isSquareAttacked(7, 4, BLACK) &&
-                    !isSquareAttacked(7, 5, BLACK) &&
-                    !isSquareAttacked(7, 6, BLACK))
-                    moves.insert(Move(KING, WHITE, { 7, 4 }, { 7, 6 }));
-            }
-            // Queenside castling.
-            if (!whiteRookAMoved && board[7][1].piece == EMPTY &&
-                board[7][2].piece == EMPTY && board[7][3].piece == EMPTY)
-            {
-                if (!isSquareAttacked(7, 4, BLACK) &&
-                    !isSquareAttacked(7, 3, BLACK) &&
-                    !isSquareAttacked(7, 2, BLACK))
-                    moves.insert(Move(KING, WHITE, { 7, 4 }, { 7, 2 }));
-            }
+            Threads.wait();
+            uciPosition(board, iss);
         }
-        else if (color == BLACK && !blackKingMoved && row == 0 && col == 4)
+        else if (command == "go")
         {
-            // Kingside castling.
-            if (!blackRookHMoved && board[0][5].piece == EMPTY && board[0][6].piece == EMPTY)
+            SearchLimits limits = parseLimits(iss);
+            Move bookMove = useBook && !limits.infinite && !limits.ponder ? book.pick(board) : Move::none();
+            if (bookMove != Move::none())
             {
-                if (!isSquareAttacked(0, 4, WHITE) &&
-                    !isSquareAttacked(0, 5, WHITE) &&
-                    !isSquareAttacked(0, 6, WHITE))
-                    moves.insert(Move(KING, BLACK, { 0, 4 }, { 0, 6 }));
-            }
-            // Queenside castling.
-            if (!blackRookAMoved && board[0][1].piece == EMPTY &&
-                board[0][2].piece == EMPTY && board[0][3].piece == EMPTY)
-            {
-                if (!isSquareAttacked(0, 4, WHITE) &&
-                    !isSquareAttacked(0, 3, WHITE) &&
-                    !isSquareAttacked(0, 2, WHITE))
-                    moves.insert(Move(KING, BLACK, { 0, 4 }, { 0, 2 }));
+                Threads.wait();
+                sendLine("info string book move");
+                sendLine("bestmove " + moveToString(bookMove));
+                continue;
             }
+            Threads.startSearch(board, limits, true, [](const SearchResult &result) {
+                string text = "bestmove " + (result.bestMove == Move::none() ? string("0000") : moveToString(result.bestMove));
+                if (result.ponderMove != Move::none())
+                    text += " ponder " + moveToString(result.ponderMove);
+                sendLine("info string " + pawnHashStats(result));
+                sendLine(text);
+            });
         }
-    }
-
-    set<Move> getPseudoLegalMoves(Color color)
-    {
-        set<Move> moves;
-        for (int row = 0; row < 8; row++)
+        else if (command == "stop")
+            Threads.stop();
+        else if (command == "ponderhit")
+            Threads.ponderhit();
+        else if (command == "setoption")
         {
-            for (int col = 0; col < 8; col++)
-            {
-                if (board[row][col].color == color)
-                {
-                    switch (board[row][col].piece)
-                    {
-                    case PAWN:
-                        generatePawnMoves(moves, row, col, color);
-                        break;
-                    case KNIGHT:
-                        generateKnightMoves(moves, row, col, color);
-                        break;
-                    case BISHOP:
-                        generateBishopMoves(moves, row, col, color);
-                        break;
-                    case ROOK:
-                        generateRookMoves(moves, row, col, color);
-                        break;
-                    case QUEEN:
-                        generateQueenMoves(moves, row, col, color);
-                        break;
-                    case KING:
-                        generateKingMoves(moves, row, col, color);
-                        break;
-                    default:
-                        break;
-                    }
-                }
-            }
+            Threads.wait();
+            uciSetOption(iss);
         }
-        return moves;
+        else if (command == "d")
+            board.printBoard();
+        else if (command == "stats")
+            uciStats(iss);
+        else if (!command.empty())
+            sendLine("info string unknown command " + command);
     }
+    Threads.stop();
+    Threads.wait();
+    return 0;
+}
 
-    // --- Helpers for Move Legality Checks ---
-    bool isSquareAttacked(int row, int col, Color attackerColor)
-    {
-        set<Move> enemyMoves = getPseudoLegalMoves(attackerColor);
-        for (const auto &move : enemyMoves)
-            if (move.to.first == row && move.to.second == col)
-                return true;
-        return false;
-    }
+int main(int argc, char *argv[])
+{
+    initAttackTables();
+    initZobrist();
+    initPsqt();
+    initPawnMasks();
+    initSearch();
+    TT.resize(16);
+    Threads.setThreadCount(1);
 
-    bool isKingInCheck(Color color)
+    // Leading options apply to whatever follows: "evalfile <path>" loads an NNUE
+    // network, "tbpath <dir>" maps the endgame tablebases, "bookfile <file>"
+    // maps a Polyglot book for go.
+    for (string option; argc >= 3 && ((option = argv[1]) == "evalfile" || option == "tbpath" || option == "bookfile");)
     {
-        int kingRow = -1, kingCol = -1;
-        for (int i = 0; i < 8; i++)
+        if (option == "bookfile" && !book.load(argv[2]))
         {
-            for (int j = 0; j < 8; j++)
-            {
-                if (board[i][j].piece == KING && board[i][j].color == color)
-                {
-                    kingRow = i;
-                    kingCol = j;
-                    break;
-                }
-            }
-            if (kingRow != -1)
-                break;
+            cout << "Cannot map book " << argv[2] << endl;
+            return 1;
         }
-        if (kingRow == -1)
-            return false;
-        Color enemy = (color == WHITE) ? BLACK : WHITE;
-        return isSquareAttacked(kingRow, kingCol, enemy);
+        if (option == "evalfile" && !network.load(argv[2]))
+        {
+            cout << "Cannot load network " << argv[2] << endl;
+            return 1;
+        }
+        if (option == "tbpath" && !tablebases.load(argv[2]))
+        {
+            cout << "No tablebases in " << argv[2] << endl;
+            return 1;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
     }
 
-    // --- Move Execution ---
-    void applyMove(const Move &move)
+    // Command-line modes: "perft <depth>" runs the built-in suite, "perft <depth> <fen>"
+    // and "divide <depth> [fen]" run a single position, "go [threads <n>] [limits]
+    // [fen <fen>]" searches one position with UCI-style limits,
+    // "smpbench [depth] [max threads]" measures multithreaded scaling,
+    // "epd <file|-> <perft|eval|search> [depth]" runs a batch over an EPD file,
+    // "pperft <depth> <threads> [fen]" and "perftscale <depth> [max threads] [fen]"
+    // run the cached multithreaded perft, "nnue <verify|bench> [net]" and
+    // "nnue write-test <file>" check the network code, "tb generate <dir> [threads]"
+    // and "tb probe <dir> <fen>" build and query the endgame tablebases,
+    // "book build <out> <pgn|epd> [max ply]", "book probe <book> [fen]" and
+    // "book test" make and query Polyglot books, "pgn <check|fens> <file|-> [threads]" validates
+    // games, and
+    // "uci" speaks the UCI protocol on stdin/stdout.
+    if (argc >= 2)
     {
-        int sr = move.from.first, sc = move.from.second;
-        int dr = move.to.first, dc = move.to.second;
-        Square &src = board[sr][sc];
-        Square &dest = board[dr][dc];
-        bool isCastling = (move.piece == KING && abs(dc - sc) == 2);
-        bool isEnPassant = (move.piece == PAWN && sc != dc && dest.piece == EMPTY);
-
-        moveHistory.push_back(move);
-
-        if (isCastling)
+        string command = argv[1];
+        if (command == "uci")
+            return runUci();
+        if (command == "go")
         {
-            board[dr][dc] = src;
-            src = Square();
-            if (dc > sc) // Kingside.
+            string args;
+            for (int i = 2; i < argc; i++)
             {
-                Square &rook = board[dr][7];
-                board[dr][dc - 1] = rook;
-                board[dr][7] = Square();
+                if (string(argv[i]) == "threads" && i + 1 < argc)
+                    Threads.setThreadCount(max(1, atoi(argv[++i])));
+                else
+                    args += string(argv[i]) + " ";
             }
-            else // Queenside.
+            istringstream iss(args);
+            SearchLimits limits = parseLimits(iss);
+            string token, fen;
+            if (iss >> token && token == "fen")
+                getline(iss, fen);
+            ChessBoard board;
+            if (!fen.empty() && !board.loadFen(fen))
             {
-                Square &rook = board[dr][0];
-                board[dr][dc + 1] = rook;
-                board[dr][0] = Square();
+                cout << "Invalid FEN: " << fen << endl;
+                return 1;
             }
-            if (move.color == WHITE)
-                whiteKingMoved = true;
-            else
-                blackKingMoved = true;
-        }
-        else
-        {
-            if (isEnPassant)
+            Move bookMove = book.pick(board);
+            if (bookMove != Move::none())
             {
-                int capturedRow = (move.color == WHITE) ? dr + 1 : dr - 1;
-                board[capturedRow][dc] = Square();
+                cout << "info string book move" << endl << "bestmove " << moveToString(bookMove) << endl;
+                return 0;
             }
-            board[dr][dc] = src;
-            src = Square();
-            if (move.promotedPiece != EMPTY)
-                board[dr][dc].piece = move.promotedPiece;
-        }
-        if (move.piece == PAWN && abs(dr - sr) == 2)
-            enPassantTarget = { (sr + dr) / 2, sc };
-        else
-            enPassantTarget = { -1, -1 };
-
-        if (move.piece == KING)
-        {
-            if (move.color == WHITE)
-                whiteKingMoved = true;
-            else
-                blackKingMoved = true;
+            SearchResult result = Threads.think(board, limits, true);
+            cout << "info string " << pawnHashStats(result) << endl;
+            cout << "bestmove " << (result.bestMove == Move::none() ? "0000" : moveToString(result.bestMove)) << endl;
+            return 0;
         }
-        if (move.piece == ROOK)
+        if (command == "epd" && argc >= 4)
+            return runEpdBatch(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : 1);
+        if (command == "pperft" && argc >= 4)
         {
-            if (move.color == WHITE)
+            string fen = startFen;
+            if (argc >= 5)
             {
-                if (sr == 7 && sc == 0)
-                    whiteRookAMoved = true;
-                if (sr == 7 && sc == 7)
-                    whiteRookHMoved = true;
+                fen.clear();
+                for (int i = 4; i < argc; i++)
+                    fen += string(argv[i]) + " ";
             }
-            else
+            ChessBoard board;
+            if (!board.loadFen(fen))
             {
-                if (sr == 0 && sc == 0)
-                    blackRookAMoved = true;
-                if (sr == 0 && sc == 7)
-                    blackRookHMoved = true;
+                cout << "Invalid FEN: " << fen << endl;
+                return 1;
             }
+            auto start = chrono::steady_clock::now();
+            uint64_t nodes = parallelPerft(board, atoi(argv[2]), atoi(argv[3]));
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "Nodes " << nodes << "  time " << fixed << setprecision(3) << seconds
+                 << " s  nps " << (uint64_t)(nodes / max(seconds, 1e-9)) << endl;
+            return 0;
         }
-    }
-
-    set<Move> getLegalMoves(Color color)
-    {
-        set<Move> legal;
-        set<Move> pseudo = getPseudoLegalMoves(color);
-        for (const auto &move : pseudo)
+        if (command == "perftscale" && argc >= 3)
         {
-            ChessBoard temp = *this;
-            temp.applyMove(move);
-            if (!temp.isKingInCheck(color))
-                legal.insert(move);
+            string fen;
+            for (int i = 4; i < argc; i++)
+                fen += string(argv[i]) + " ";
+            return runPerftScaling(atoi(argv[2]), argc >= 4 ? atoi(argv[3]) : 32, fen.empty() ? startFen : fen);
         }
-        return legal;
-    }
-
-    // --- Bitboard Generation ---
-    Bitboards getBitboards() const
-    {
-        Bitboards bb = { 0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL,
-                         0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL };
-        for (int row = 0; row < 8; row++)
+        if (command == "pgn" && argc >= 4)
+            return runPgnPipeline(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : int(thread::hardware_concurrency()));
+        if (command == "book" && argc == 3 && string(argv[2]) == "test")
+            return runBookCommand("test", "", "");
+        if (command == "book" && argc >= 4)
         {
-            for (int col = 0; col < 8; col++)
+            string arg;
+            for (int i = 4; i < argc; i++)
+                arg += (arg.empty() ? "" : " ") + string(argv[i]);
+            return runBookCommand(argv[2], argv[3], arg);
+        }
+        if (command == "tb" && argc >= 4)
+        {
+            string arg;
+            for (int i = 4; i < argc; i++)
+                arg += (arg.empty() ? "" : " ") + string(argv[i]);
+            return runTablebaseCommand(argv[2], argv[3], arg);
+        }
+        if (command == "match" && argc >= 4)
+            return runMatch(vector<string>(argv + 2, argv + argc));
+        if (command == "datagen" && argc >= 4 && string(argv[2]) == "play")
+            return runDatagen(vector<string>(argv + 3, argv + argc));
+        if (command == "datagen" && argc >= 4 && string(argv[2]) == "read")
+            return runDatagenRead(argv[3], argc >= 5 ? strtoull(argv[4], nullptr, 10) : UINT64_MAX);
+        if (command == "nnue" && argc >= 3)
+            return runNnueCommand(argv[2], argc >= 4 ? argv[3] : "");
+        if (command == "smpbench")
+            return runSmpBench(argc >= 3 ? atoi(argv[2]) : 10, argc >= 4 ? atoi(argv[3]) : 32);
+        int depth = (argc >= 3) ? atoi(argv[2]) : 0;
+        string fen;
+        for (int i = 3; i < argc; i++)
+            fen += (fen.empty() ? "" : " ") + string(argv[i]);
+        if ((command == "perft" || command == "divide") && depth > 0)
+        {
+            if (command == "divide")
+                return runDivide(depth, fen.empty() ? startFen : fen);
+            if (fen.empty())
+                return runPerftSuite(depth);
+            ChessBoard board;
+            if (!board.loadFen(fen))
             {
-                int index = row * 8 + col;
-                uint64_t bit = 1ULL << index;
-                const Square &sq = board[row][col];
-                if (sq.piece != EMPTY)
-                {
-                    if (sq.color == WHITE)
-                    {
-                        switch (sq.piece)
-                        {
-                        case PAWN:
-                            bb.whitePawns |= bit;
-                            break;
-                        case KNIGHT:
-                            bb.whiteKnights |= bit;
-                            break;
-                        case BISHOP:
-                            bb.whiteBishops |= bit;
-                            break;
-                        case ROOK:
-                            bb.whiteRooks |= bit;
-                            break;
-                        case QUEEN:
-                            bb.whiteQueens |= bit;
-                            break;
-                        case KING:
-                            bb.whiteKing |= bit;
-                            break;
-                        default:
-                            break;
-                        }
-                    }
-                    else if (sq.color == BLACK)
-                    {
-                        switch (sq.piece)
-                        {
-                        case PAWN:
-                            bb.blackPawns |= bit;
-                            break;
-                        case KNIGHT:
-                            bb.blackKnights |= bit;
-                            break;
-                        case BISHOP:
-                            bb.blackBishops |= bit;
-                            break;
-                        case ROOK:
-                            bb.blackRooks |= bit;
-                            break;
-                        case QUEEN:
-                            bb.blackQueens |= bit;
-                            break;
-                        case KING:
-                            bb.blackKing |= bit;
-                            break;
-                        default:
-                            break;
-                        }
-                    }
-                }
+                cout << "Invalid FEN: " << fen << endl;
+                return 1;
             }
+            auto start = chrono::steady_clock::now();
+            uint64_t nodes = perft(board, depth);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "Nodes " << nodes << "  time " << fixed << setprecision(3) << seconds
+                 << " s  nps " << (uint64_t)(nodes / max(seconds, 1e-9)) << endl;
+            return 0;
         }
-        return bb;
+        cout << "Usage: " << argv[0] << " [perft <depth> [fen] | divide <depth> [fen] | go [threads <n>] [limits] [fen <fen>] | smpbench [depth] [max threads] |\n"
+             << "  epd <file|-> <perft|eval|search> [depth] | pperft <depth> <threads> [fen] |\n"
+             << "  perftscale <depth> [max threads] [fen] | nnue <verify|bench|write-test> [net] |\n"
+             << "  tb generate <dir> [threads] | tb probe <dir> <fen> | book build <out> <pgn|epd> [max ply] |\n"
+             << "  book probe <book> [fen] | book test | pgn <check|fens> <file|-> [threads] |\n"
+             << "  match <engine> <engine> [games <n>] [concurrency <n>] [openings <epd>] [sprt <elo0> <elo1>] [alpha <a>] [beta <b>] |\n"
+             << "  datagen play <out> <engine> [positions <n>] [threads <n>] [random <plies>] [seed <n>] | datagen read <file> [limit] | uci]\n"
+             << "Leading options: \"evalfile <net>\" evaluates with an NNUE network, \"tbpath <dir>\" probes tablebases,\n"
+             << "\"bookfile <file>\" plays from a Polyglot book." << endl;
+        return 1;
     }
-};
 
-int main()
-{
     ChessBoard board;
     Color currentTurn = WHITE;
     string inputLine;
@@ -594,18 +7031,47 @@ int main()
     {
         board.printBoard();
         cout << "\n" << ((currentTurn == WHITE) ? "White" : "Black")
-             << " to move. Enter move as: fromRow fromCol toRow toCol (or type 'exit'): ";
-        getline(cin, inputLine);
-        if (inputLine == "exit")
+             << " to move. Enter move as: fromRow fromCol toRow toCol (or type 'go' or 'exit'): ";
+        if (!getline(cin, inputLine) || inputLine == "exit")
             break;
+        // A GUI announces itself with "uci"; switch to the protocol loop.
+        if (inputLine == "uci")
+            return runUci();
+        // Let the engine pick the move for the side to play.
+        if (inputLine == "go")
+        {
+            SearchLimits limits;
+            limits.movetime = 1000;
+            SearchResult result = Threads.think(board, limits, false);
+            if (result.bestMove == Move::none())
+            {
+                cout << "No legal moves." << endl;
+                continue;
+            }
+            cout << "Engine plays " << moveToString(result.bestMove) << " (score " << scoreToString(result.score)
+                 << ", depth " << result.depth << ")" << endl;
+            board.applyMove(result.bestMove);
+            currentTurn = (currentTurn == WHITE) ? BLACK : WHITE;
+            continue;
+        }
 
         istringstream iss(inputLine);
         int sr, sc, dr, dc;
-        if (!(iss >> sr >> sc >> dr >> dc))
+        if (!(iss >> sr >> sc >> dr >> dc) || min({ sr, sc, dr, dc }) < 0 || max({ sr, sc, dr, dc }) > 7)
         {
             cout << "Invalid input. Please enter four integers." << endl;
             continue;
         }
+        // An optional fifth token picks the promotion piece (q, r, b or n); queen by default.
+        string promoText;
+        iss >> promoText;
+        Piece promo = QUEEN;
+        if (!promoText.empty())
+        {
+            size_t idx = string("pnbrq").find(tolower(promoText[0]));
+            if (idx != string::npos && idx > 0)
+                promo = Piece(idx + 1);
+        }
         // Retrieve the piece at the source square.
         Square sourceSquare = board.getSquare(sr, sc);
         if (sourceSquare.piece == EMPTY || sourceSquare.color != currentTurn)
@@ -613,9 +7079,12 @@ int main()
             cout << "No valid piece at the source square for the current turn." << endl;
             continue;
         }
-        Move playerMove(sourceSquare.piece, sourceSquare.color, { sr, sc }, { dr, dc });
-        set<Move> legalMoves = board.getLegalMoves(currentTurn);
-        if (legalMoves.find(playerMove) == legalMoves.end())
+        Move playerMove = Move::none();
+        for (Move move : board.getLegalMoves(currentTurn))
+            if (move.from() == squareIndex(sr, sc) && move.to() == squareIndex(dr, dc) &&
+                (move.type() != PROMOTION || move.promotedPiece() == promo))
+                playerMove = move;
+        if (playerMove == Move::none())
         {
             cout << "Illegal move. Try again." << endl;
             continue;